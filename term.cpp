@@ -20,7 +20,10 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <termios.h>
+#include <poll.h>
+#include <fcntl.h>
 #endif
+#include "zlib.h"
 #include "core/app/app.h"
 #include "core/app/gl/view.h"
 #include "core/app/gl/terminal.h"
@@ -38,8 +41,12 @@
 #ifdef LFL_FLATBUFFERS
 #include "LTerminal/term_generated.h"
 #endif
-#if defined(__APPLE__) && !defined(LFL_TERMINAL_MENUS) && !defined(LFL_QT)
-#define LFL_TERMINAL_JOIN_READS
+#ifdef LFL_MOSH
+#include "network/networktransport-impl.h"
+#include "statesync/completeterminal.h"
+#include "statesync/user.h"
+#include "frontend/terminaloverlay.h"
+#include "terminal/terminaldisplay.h"
 #endif
 
 namespace LFL {
@@ -51,7 +58,15 @@ DEFINE_bool  (compress,        false,  "SSH compression");
 DEFINE_bool  (forward_agent,   false,  "SSH agent forwarding");
 DEFINE_string(forward_local,   "",     "Forward local_port:remote_host:remote_port");
 DEFINE_string(forward_remote,  "",     "Forward remote_port:local_host:local_port");
+DEFINE_int   (forward_backlog, 16,     "Listen backlog for local port forwards");
+DEFINE_int   (reconnect_attempts, 5,   "Automatically reconnect dropped SSH sessions this many times");
+DEFINE_string(forward_dynamic, "",     "Forward local_port[,local_port] as a SOCKS5 proxy");
+DEFINE_bool  (local_echo,      false,  "Predict SSH keystroke echo locally");
+#ifdef LFL_MOSH
+DEFINE_bool  (mosh,            false,  "Connect --ssh host with mosh-server");
+#endif
 DEFINE_string(keygen,          "",     "Generate key");
+DEFINE_int   (keygen_count,    1,      "Number of keys to generate in parallel");
 DEFINE_int   (bits,            0,      "Generate key bits");      
 #endif
 DEFINE_bool  (interpreter,     false,  "Launch interpreter instead of shell");
@@ -62,8 +77,21 @@ DEFINE_string(command,         "",     "Execute initial command");
 DEFINE_string(screenshot,      "",     "Screenshot and exit");
 DEFINE_string(record,          "",     "Record session to file");
 DEFINE_string(playback,        "",     "Playback recorded session file");
+DEFINE_float (playback_speed,  1,      "Playback speed multiplier, 0 plays back as fast as possible");
+DEFINE_bool  (playback_debug,  false,  "Dump played back records to stderr");
+DEFINE_int   (playback_seek,   0,      "Start playback this many seconds into the recording");
+DEFINE_int   (record_keyframe_interval, 10, "Seconds between recording index keyframes, 0 disables the index");
+DEFINE_bool  (record_backpressure, false, "Stall output instead of dropping it when the recorder falls behind");
+DEFINE_bool  (record_compress, true, "Deflate session recordings");
 DEFINE_bool  (draw_fps,        false,  "Draw FPS");
+DEFINE_bool  (join_reads,      true,   "Defer redraws while terminal output is flooding");
+DEFINE_int   (join_reads_fps,  30,     "Redraw rate while terminal output is flooding");
+DEFINE_int   (join_reads_size, 255,    "Reads larger than this defer the redraw");
+DEFINE_int   (join_reads_rate, 16384,  "Output bytes/sec above which redraws are deferred");
 DEFINE_bool  (resize_grid,     true,   "Resize window in glyph bound increments");
+DEFINE_int   (paste_high_water, 65536, "Bytes of pasted text allowed in the controller's write queue");
+DEFINE_int   (paste_chunk_ms,  10,     "Milliseconds between streamed paste chunks");
+DEFINE_bool  (pty_thread,      false,  "Read the local shell PTY on a dedicated thread");
 DEFINE_FLAG(dim, point, point(80,25),  "Initial terminal dimensions");
 #ifndef LFL_MOBILE
 DEFINE_bool  (single_instance, LINUXOS||WINDOWSOS, "Run a single instance of LTerminal");
@@ -78,7 +106,8 @@ struct MyApp : public Application {
   unordered_map<string, Shader> shader_map;
   unique_ptr<Browser> image_browser;
   unique_ptr<TimerInterface> flash_timer;
-  unique_ptr<AlertViewInterface> flash_alert, info_alert, confirm_alert, text_alert, passphrase_alert, passphraseconfirm_alert;
+  unique_ptr<AlertViewInterface> flash_alert, info_alert, confirm_alert, text_alert, passphrase_alert, passphraseconfirm_alert,
+    keygen_alert, paste_alert;
   unique_ptr<MenuViewInterface> edit_menu, view_menu, toys_menu;
   unique_ptr<MyTerminalMenus> menus;
   function<unique_ptr<ToolbarViewInterface>(Window*, const string&, MenuItemVec, int)> create_toolbar;
@@ -115,15 +144,27 @@ namespace LFL {
 
 struct MyTerminalTab : public TerminalTab {
   TerminalWindowInterface<TerminalTabInterface> *parent;
-  Time join_read_interval = Time(100), refresh_interval = Time(33);
-  int join_read_pending = 0;
   bool add_reconnect_links = true;
+  TerminalReadCoalescer join_reads;
   FrameWakeupTimer timer;
+  unique_ptr<TimerInterface> reconnect_timer, paste_timer;
+  unique_ptr<TerminalPasteStreamer> paste;
+  TerminalControllerInterface *paste_controller = 0;
+  bool paste_alert_shown = false;
+  Callback reconnect_pending_cb;
+  weak_ptr<bool> reconnect_waiting;
+  int reconnect_attempt = 0;
+#ifdef LFL_CRYPTO
+  string reconnect_fingerprint;
+  int reconnect_fingerprint_type = 0;
+  shared_ptr<SSHClient::Identity> reconnect_identity;
+#endif
   v2 zoom_val = v2(100, 100);
 
-  virtual ~MyTerminalTab() { root->DelView(terminal); }
+  virtual ~MyTerminalTab() { CancelReconnect(); CancelPaste(); root->DelView(terminal); }
   MyTerminalTab(Window *W, TerminalWindowInterface<TerminalTabInterface> *P, int host_id, bool hide_sb) :
-    TerminalTab(W, "MyTerminalTab", W->AddView(make_unique<Terminal>(nullptr, W, W->default_font, FLAGS_dim)), host_id, hide_sb), parent(P), timer(W) {
+    TerminalTab(W, "MyTerminalTab", W->AddView(make_unique<Terminal>(nullptr, W, W->default_font, FLAGS_dim)), host_id, hide_sb), parent(P),
+    join_reads(Time(1000 / max(1, FLAGS_join_reads_fps)), FLAGS_join_reads_size, FLAGS_join_reads_rate), timer(W) {
     terminal->new_link_cb      = bind(&MyTerminalTab::NewLinkCB,   this, _1);
     terminal->hover_control_cb = bind(&MyTerminalTab::HoverLinkCB, this, _1);
     if (terminal->bg_color) W->gd->clear_color = terminal->bg_color;
@@ -131,9 +172,7 @@ struct MyTerminalTab : public TerminalTab {
 
   bool GetFocused() const override { return parent->tabs.top == this; }
   void Draw(const point &p) override {
-#ifdef LFL_TERMINAL_JOIN_READS
     timer.ClearWakeupIn();
-#endif
     DrawBox(root->gd, root->Box(), true);
   }
 
@@ -169,10 +208,43 @@ struct MyTerminalTab : public TerminalTab {
     INFO("Font: ", app->fonts->DefaultFontEngine()->DebugString(terminal->style.font));
   }
 
-  void UsePlaybackTerminalController(unique_ptr<FlatFile> f) {
+  void UsePlaybackTerminalController(const string &fn) {
     networked = false;
     title = LS("playback");
-    ChangeController(make_unique<PlaybackTerminalController>(this, move(f)));
+    ChangeController(make_unique<PlaybackTerminalController>(this, fn, FLAGS_playback_speed, FLAGS_playback_debug));
+    if (FLAGS_playback_seek) dynamic_cast<PlaybackTerminalController*>(controller.get())->Seek(Seconds(FLAGS_playback_seek));
+  }
+
+  void PasteText(const string &text) {
+    if (!controller) return;
+    CancelPaste();
+    paste = make_unique<TerminalPasteStreamer>(text, paste_mode.bracketed, size_t(max(1, FLAGS_paste_high_water)));
+    paste_controller = controller.get();
+    if (!paste_timer) paste_timer = SystemToolkit::CreateTimer(bind(&MyTerminalTab::PasteStep, this));
+    PasteStep();
+    if (!paste) return;
+    paste_alert_shown = true;
+    app->paste_alert->ShowCB(LS("pasting"), StrCat(paste->data.size() / 1024, " KB"), "", [=](const string&) { CancelPaste(); });
+  }
+
+  void PasteStep() {
+    if (!paste) return;
+    if (controller.get() != paste_controller) return CancelPaste();
+    if (paste->Step(controller.get()) < 0) { ERROR("paste write failed at ", paste->offset, "/", paste->data.size()); return CancelPaste(); }
+    if (paste->Done()) return CancelPaste();
+    paste_timer->Run(Time(FLAGS_paste_chunk_ms), true);
+  }
+
+  void CancelPaste() {
+    if (!paste) return;
+    paste.reset();
+    paste_controller = 0;
+    if (paste_alert_shown) app->paste_alert->Hide();
+    paste_alert_shown = false;
+  }
+
+  void SeekPlayback(Time d) {
+    if (auto playback = dynamic_cast<PlaybackTerminalController*>(controller.get())) playback->SeekBy(d);
   }
 
   void UseShellTerminalController(const string &m, bool commands=true, Callback reconnect_cb=Callback()) {
@@ -187,6 +259,14 @@ struct MyTerminalTab : public TerminalTab {
     c->ssh_term = FLAGS_term;
 #ifdef LFL_CRYPTO
     c->ssh_cb = [=](SSHClient::Params p){ UseSSHTerminalController(move(p), true, ""); };
+    c->forwards_cb = [=](){
+      string ret;
+      for (auto &t : parent->tabs.tabs)
+        if (auto ssh = dynamic_cast<SSHTerminalController*>(t->controller.get()))
+          if (ssh->local_forwards.size() || ssh->remote_forwards.size())
+            StrAppend(&ret, t->title, ":\r\n", ssh->ForwardReport());
+      return ret;
+    };
 #endif
 #ifdef LFL_RFB
     c->vnc_cb = [=](RFBClient::Params p){ parent->AddRFBTab(1, !ANDROIDOS, move(p), ""); };
@@ -209,29 +289,109 @@ struct MyTerminalTab : public TerminalTab {
   UseSSHTerminalController(SSHClient::Params params, bool from_shell=false, const string &pw="",
                            SSHClient::LoadIdentityCB identity_cb=SSHClient::LoadIdentityCB(),
                            SSHTerminalController::SavehostCB savehost_cb=SSHTerminalController::SavehostCB(),
-                           SSHClient::FingerprintCB fingerprint_cb=SSHClient::FingerprintCB()) {
+                           SSHClient::FingerprintCB fingerprint_cb=SSHClient::FingerprintCB(),
+                           unordered_map<int, int> forward_backlog=unordered_map<int, int>(),
+                           vector<int> forward_dynamic=vector<int>(), bool local_echo=false) {
     networked = true;
     title = StrCat(LS("ssh"), " ", params.user, "@", params.hostport);
     bool close_on_disconn = params.close_on_disconnect;
     Callback reconnect_cb = (!add_reconnect_links || close_on_disconn) ? Callback() : [=](){
       if (dynamic_cast<InteractiveTerminalController*>(controller.get()))
-        UseSSHTerminalController(params, from_shell, pw, identity_cb, SSHTerminalController::SavehostCB(), fingerprint_cb);
+        UseSSHTerminalController(params, from_shell, pw, identity_cb, SSHTerminalController::SavehostCB(), fingerprint_cb, forward_backlog,
+                                 forward_dynamic, local_echo);
     };
     auto ssh = make_unique<SSHTerminalController>(this, move(params), close_on_disconn ? closed_cb : [=, r = move(reconnect_cb)]() {
+      if (r && AutoReconnectSSH(dynamic_cast<SSHTerminalController*>(controller.get()), r)) return;
       UseReconnectTerminalController(StrCat("\r\n", LS("session_ended"), ".\r\n\r\n\r\n"), from_shell, move(r));
     });
     auto ret = ssh.get();
     ssh->metakey_cb = bind(&TerminalTabInterface::ToggleToolbarButton, this, _1);
     ssh->savehost_cb = move(savehost_cb);
-    ssh->fingerprint_cb = move(fingerprint_cb);
+    ssh->fingerprint_cb = [=, cb = move(fingerprint_cb)](int type, const StringPiece &fp) {
+      if (reconnect_attempt && type == reconnect_fingerprint_type && fp.str() == reconnect_fingerprint) return true;
+      return cb ? cb(type, fp) : true;
+    };
     ssh->passphrase_alert = app->passphrase_alert.get();
-    ssh->identity_cb = identity_cb;
+    ssh->login_cb = [=](){ reconnect_attempt = 0; };
+    ssh->identity_cb = [=](shared_ptr<SSHClient::Identity> *out) {
+      if (reconnect_attempt && reconnect_identity) { *out = reconnect_identity; return true; }
+      return identity_cb ? identity_cb(out) : true;
+    };
+    ssh->forward_backlog = move(forward_backlog);
+    ssh->forward_dynamic = move(forward_dynamic);
+    ssh->default_forward_backlog = FLAGS_forward_backlog;
+    if (local_echo || FLAGS_local_echo) ssh->local_echo = make_unique<TerminalLocalEcho>();
     if (pw.size()) ssh->password = pw;
     ChangeController(move(ssh));
     return ret;
   }
+
+#ifdef LFL_MOSH
+  void UseMoshTerminalController(SSHClient::Params params, const string &pw="",
+                                 SSHClient::LoadIdentityCB identity_cb=SSHClient::LoadIdentityCB(),
+                                 SSHClient::FingerprintCB fingerprint_cb=SSHClient::FingerprintCB()) {
+    networked = true;
+    title = StrCat(LS("mosh"), " ", params.user, "@", params.hostport);
+    if (params.hostport.find('[') != string::npos || count(params.hostport.begin(), params.hostport.end(), ':') > 1)
+      return UseReconnectTerminalController(StrCat("\r\n", LS("mosh_requires_ipv4"), ".\r\n\r\n\r\n"), false);
+    params.startup_command = "mosh-server new -s -l LANG=en_US.UTF-8\r";
+    auto mosh = make_unique<MoshBootstrapTerminalController>(this, move(params), closed_cb);
+    auto ret = mosh.get();
+    mosh->metakey_cb = bind(&TerminalTabInterface::ToggleToolbarButton, this, _1);
+    mosh->fingerprint_cb = move(fingerprint_cb);
+    mosh->passphrase_alert = app->passphrase_alert.get();
+    mosh->identity_cb = move(identity_cb);
+    if (pw.size()) mosh->password = pw;
+    mosh->connect_cb = [=](const string &ip, const string &port, const string &key) {
+      app->RunInMainThread([=](){
+        if (controller.get() != ret) return;
+        ret->close_cb = Callback();
+        ret->Close();
+        ChangeController(make_unique<MoshTerminalController>
+                         (this, ip, port, key, terminal->term_width, terminal->term_height, [=](){
+          UseReconnectTerminalController(StrCat("\r\n", LS("session_ended"), ".\r\n\r\n\r\n"), false, Callback());
+        }));
+      });
+    };
+    ChangeController(move(mosh));
+  }
+#endif
+
+  bool AutoReconnectSSH(SSHTerminalController *ssh, Callback reconnect_cb) {
+    bool logged_in = ssh && ssh->logged_in;
+    if (!ssh || !ssh->dropped || (!logged_in && !reconnect_attempt) || reconnect_attempt >= FLAGS_reconnect_attempts) {
+      reconnect_attempt = 0;
+      reconnect_identity.reset();
+      return false;
+    }
+    if (logged_in) {
+      reconnect_fingerprint = ssh->fingerprint;
+      reconnect_fingerprint_type = ssh->fingerprint_type;
+      if (ssh->loaded_identity) reconnect_identity = ssh->loaded_identity;
+    }
+
+    int delay = min(30, 1 << reconnect_attempt++);
+    UseShellTerminalController(StrCat("\r\n", LS("connection_lost"), ", ", LS("reconnecting_in"), " ", delay, "s (",
+                                      reconnect_attempt, "/", FLAGS_reconnect_attempts, ")\r\n"), false,
+                               [=](){ CancelReconnect(); reconnect_cb(); });
+    reconnect_pending_cb = move(reconnect_cb);
+    reconnect_waiting = controller->alive;
+    if (!reconnect_timer) reconnect_timer = SystemToolkit::CreateTimer([=](){
+      Callback cb;
+      swap(cb, reconnect_pending_cb);
+      if (cb && !reconnect_waiting.expired()) cb();
+    });
+    reconnect_timer->Run(Seconds(delay), true);
+    return true;
+  }
 #endif
 
+  void CancelReconnect() {
+    reconnect_pending_cb = Callback();
+    reconnect_waiting.reset();
+    if (reconnect_timer) reconnect_timer->Clear();
+  }
+
   void UseTelnetTerminalController(const string &hostport, bool from_shell=false, bool close_on_disconn=false,
                                    Callback savehost_cb=Callback()) {
     networked = true;
@@ -254,12 +414,14 @@ struct MyTerminalTab : public TerminalTab {
     UseShellTerminalController("");
 #else
     if (FLAGS_term.empty()) setenv("TERM", (FLAGS_term = "xterm").c_str(), 1);
-    ChangeController(make_unique<PTYTerminalController>(this));
+    auto pty = make_unique<PTYTerminalController>(this);
+    pty->threaded = FLAGS_pty_thread;
+    ChangeController(move(pty));
 #endif
   }
 
   void UseInitialTerminalController() {
-    if      (FLAGS_playback.size()) return UsePlaybackTerminalController(make_unique<FlatFile>(FLAGS_playback));
+    if      (FLAGS_playback.size()) return UsePlaybackTerminalController(FLAGS_playback);
     else if (FLAGS_interpreter)     return UseShellTerminalController("");
 #ifdef LFL_CRYPTO
     else if (FLAGS_ssh.size()) {
@@ -267,6 +429,8 @@ struct MyTerminalTab : public TerminalTab {
         FLAGS_forward_agent, 0};
       if (FLAGS_forward_local .size()) SSHClient::ParsePortForward(FLAGS_forward_local,  &params.forward_local);
       if (FLAGS_forward_remote.size()) SSHClient::ParsePortForward(FLAGS_forward_remote, &params.forward_remote);
+      vector<int> forward_dynamic;
+      for (auto &p : Split(FLAGS_forward_dynamic, ',')) if (int port = atoi(p)) forward_dynamic.push_back(port);
       SSHClient::LoadIdentityCB identity_cb;
       if (!FLAGS_keyfile.empty()) {
         INFO("Load keyfile ", FLAGS_keyfile);
@@ -275,7 +439,11 @@ struct MyTerminalTab : public TerminalTab {
                               [&](string v) { return app->passphrase_alert->RunModal(v); })) identity.reset();
         if (identity) identity_cb = [=](shared_ptr<SSHClient::Identity> *out) { *out = identity; return true; };
       }
-      return ReturnVoid(UseSSHTerminalController(params, false, string(), identity_cb));
+#ifdef LFL_MOSH
+      if (FLAGS_mosh) return UseMoshTerminalController(params, string(), identity_cb);
+#endif
+      return ReturnVoid(UseSSHTerminalController(params, false, string(), identity_cb, SSHTerminalController::SavehostCB(),
+                                                 SSHClient::FingerprintCB(), unordered_map<int, int>(), move(forward_dynamic)));
     }
 #endif
     else if (FLAGS_telnet.size()) return UseTelnetTerminalController(FLAGS_telnet);
@@ -288,17 +456,8 @@ struct MyTerminalTab : public TerminalTab {
 
   bool ControllerReadableCB() override {
     int read_size = ReadAndUpdateTerminalFramebuffer();
-    if (!parent->root->animating) {
-#ifdef LFL_TERMINAL_JOIN_READS
-      if (read_size) {
-        int *pending = &join_read_pending;
-        bool join_read = read_size > 255;
-        if (join_read) { if (1            && ++(*pending)) { if (timer.WakeupIn(join_read_interval)) return false; } }
-        else           { if ((*pending)<1 && ++(*pending)) { if (timer.WakeupIn(refresh_interval))   return false; } }
-        *pending = 0;
-      }
-#endif
-    }
+    if (read_size && FLAGS_join_reads && !parent->root->animating && join_reads.DeferDraw(read_size, Now()))
+      if (timer.WakeupIn(join_reads.refresh_interval)) return false;
     return GetFocused() && read_size > 0;
   }
 
@@ -484,7 +643,8 @@ MyTerminalTab *MyTerminalWindow::AddTerminalTab(int host_id, bool hide_statusbar
 #ifdef LFL_TERMINAL_MENUS
   t->terminal->line_fb.align_top_or_bot = t->terminal->cmd_fb.align_top_or_bot = true;
   if (atoi(Application::GetSetting("record_session")))
-    t->record = make_unique<FlatFile>(StrCat(app->savedir, "session_", logfiletime(Now()), ".data"));
+    t->StartRecording(StrCat(app->savedir, "session_", logfiletime(Now()), ".data"), Seconds(FLAGS_record_keyframe_interval),
+                      FLAGS_record_backpressure, FLAGS_record_compress);
   t->terminal->resize_gui_ind.push_back(t->terminal->mouse.AddZoomBox(Box(), MouseController::ScaleCB([=](int button, v2 p, v2 d, int down) {
     t->zoom_val = t->zoom_val * d;
     int font_size = root->default_font.desc.size, delta=0;
@@ -565,6 +725,8 @@ void MyApp::OnWindowStart(Window *W) {
   binds->Add('[',       Key::Modifier::Cmd, Bind::CB(bind([=](){ tw->tabs.SelectPrevTab();  W->Wakeup(); })));
   binds->Add(Key::Up,   Key::Modifier::Cmd, Bind::CB(bind([=](){ t->ScrollUp();             W->Wakeup(); })));
   binds->Add(Key::Down, Key::Modifier::Cmd, Bind::CB(bind([=](){ t->ScrollDown();           W->Wakeup(); })));
+  binds->Add(Key::Left, Key::Modifier::Cmd, Bind::CB(bind([=](){ if (auto tt = dynamic_cast<MyTerminalTab*>(t)) tt->SeekPlayback(Seconds(-10)); W->Wakeup(); })));
+  binds->Add(Key::Right,Key::Modifier::Cmd, Bind::CB(bind([=](){ if (auto tt = dynamic_cast<MyTerminalTab*>(t)) tt->SeekPlayback(Seconds( 10)); W->Wakeup(); })));
   binds->Add('=',       Key::Modifier::Cmd, Bind::CB(bind([=](){ t->SetFontSize(W->default_font.desc.size + 1); })));
   binds->Add('-',       Key::Modifier::Cmd, Bind::CB(bind([=](){ t->SetFontSize(W->default_font.desc.size - 1); })));
   binds->Add('6',       Key::Modifier::Cmd, Bind::CB(bind([=](){ W->shell->console(StringVec()); })));
@@ -678,6 +840,10 @@ extern "C" int MyAppMain(LFApp*) {
     { "style", "pwinput" }, { LS("passphrase"), LS("passphrase") }, { LS("cancel"), "" }, { LS("continue_"), "" } });
   app->passphraseconfirm_alert = app->system_toolkit->CreateAlert(app->focused, AlertItemVec{
     { "style", "pwinput" }, { LS("passphrase"), LS("confirm_passphrase") }, { LS("cancel"), "" }, { LS("continue_"), "" } });
+  app->keygen_alert = app->system_toolkit->CreateAlert(app->focused, AlertItemVec{
+    { "style", "" }, { "", "" }, { "", "" }, { LS("cancel"), "" } });
+  app->paste_alert = app->system_toolkit->CreateAlert(app->focused, AlertItemVec{
+    { "style", "" }, { "", "" }, { "", "" }, { LS("cancel"), "" } });
 #ifndef LFL_TERMINAL_MENUS
   app->edit_menu = app->system_toolkit->CreateEditMenu(app->focused, vector<MenuItem>());
   app->view_menu = app->system_toolkit->CreateMenu(app->focused, "View", MenuItemVec{
@@ -727,12 +893,24 @@ extern "C" int MyAppMain(LFApp*) {
   INFO("Using ", Crypto::LibraryName(), " cryptography");
   Crypto::PublicKeyInit();
   if (FLAGS_keygen.size()) {
-    string pw = app->passphrase_alert->RunModal(""), fn="identity", pubkey, privkey;
-    if (!Crypto::GenerateKey(FLAGS_keygen, FLAGS_bits, pw, "", &pubkey, &privkey))
-      return ERRORv(-1, "keygen ", FLAGS_keygen, " bits=", FLAGS_bits, ": failed");
-    LocalFile(fn, "w").WriteString(privkey);
-    LocalFile(StrCat(fn, ".pub"), "w").WriteString(pubkey);
-    INFO("Wrote ", fn, " and ", fn, ".pub");
+    string pw = app->passphrase_alert->RunModal("");
+    int count = max(1, FLAGS_keygen_count), workers = min(count, max(1, int(thread::hardware_concurrency())));
+    vector<pair<string, string>> keys(count);
+    vector<char> success(count);
+    atomic<int> next_key(0);
+    vector<thread> pool;
+    for (int i = 0; i < workers; i++) pool.emplace_back([&](){
+      for (int k = next_key++; k < count; k = next_key++)
+        success[k] = Crypto::GenerateKey(FLAGS_keygen, FLAGS_bits, pw, "", &keys[k].first, &keys[k].second);
+    });
+    for (auto &t : pool) t.join();
+    for (int i = 0; i < count; i++) {
+      if (!success[i]) return ERRORv(-1, "keygen ", FLAGS_keygen, " bits=", FLAGS_bits, ": failed");
+      string fn = i ? StrCat("identity", i+1) : "identity";
+      LocalFile(fn, "w").WriteString(keys[i].second);
+      LocalFile(StrCat(fn, ".pub"), "w").WriteString(keys[i].first);
+      INFO("Wrote ", fn, " and ", fn, ".pub");
+    }
     return 1;
   }
 #endif
@@ -764,7 +942,8 @@ extern "C" int MyAppMain(LFApp*) {
   if (auto t = dynamic_cast<MyTerminalTab*>(tw->tabs.top)) {
     app->new_win_width  = t->terminal->style.font->FixedWidth() * t->terminal->term_width;
     app->new_win_height = t->terminal->style.font->Height()     * t->terminal->term_height;
-    if (FLAGS_record.size()) t->record = make_unique<FlatFile>(FLAGS_record);
+    if (FLAGS_record.size()) t->StartRecording(FLAGS_record, Seconds(FLAGS_record_keyframe_interval),
+                                               FLAGS_record_backpressure, FLAGS_record_compress);
     t->terminal->Draw(app->focused->Box());
     INFO("Starting ", app->name, " ", app->focused->default_font.desc.name, " (w=", t->terminal->style.font->FixedWidth(),
          ", h=", t->terminal->style.font->Height(), ", scale=", app->downscale_effects, ")");
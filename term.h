@@ -26,8 +26,12 @@ typedef function<void(TerminalTabInterface*)> TerminalTabCB;
 struct TerminalControllerInterface : public Terminal::Controller {
   TerminalTabInterface *parent;
   StringCB metakey_cb;
+  shared_ptr<bool> alive = make_shared<bool>(true);
   TerminalControllerInterface(TerminalTabInterface *P) : parent(P) {}
   virtual int GetConnectionState() const { return Connection::Error; }
+  virtual size_t GetWriteQueueSize() const { return 0; }
+  virtual void ReadConsumed() {}
+  virtual StringPiece RecordData(const StringPiece &b) { return b; }
 
 #ifndef LFL_TERMINAL_MENUS
   StringPiece GetMetaModified(const StringPiece &b, char*) { return b; }
@@ -121,23 +125,65 @@ struct TerminalTabInterface : public Dialog {
   }
 };
 
+// Only accessed from the network thread.
+struct TerminalDNSCache {
+  struct Entry { IPV4::Addr addr; Time expires; };
+  unordered_map<string, Entry> cache;
+  unordered_set<string> pending;
+  Time ttl=Seconds(300);
+
+  bool Get(const string &host, IPV4::Addr *out) {
+    auto it = cache.find(host);
+    if (it == cache.end()) return false;
+    if (Now() > it->second.expires) { cache.erase(it); return false; }
+    *out = it->second.addr;
+    return true;
+  }
+
+  void Put(const string &host, IPV4::Addr addr) {
+    if (!addr || addr == IPV4::Addr(-1)) return;
+    cache[host] = Entry{ addr, Now() + ttl };
+  }
+
+  void Lookup(const string &host, function<void(IPV4::Addr)> cb) {
+    IPV4::Addr addr;
+    if (Get(host, &addr)) { if (cb) cb(addr); return; }
+    if (!cb && !pending.insert(host).second) return;
+    app->net->system_resolver->NSLookup(host, [=](IPV4::Addr a, DNS::Response*) {
+      pending.erase(host);
+      Put(host, a);
+      if (cb) cb(a);
+    });
+  }
+
+  string Resolve(const string &hostport) {
+    IPV4::Addr addr;
+    size_t colon = hostport.find(':');
+    if (colon != string::npos && hostport.find(':', colon+1) != string::npos) return hostport;
+    if (!Get(hostport.substr(0, colon), &addr)) return hostport;
+    return StrCat(IPV4::Text(addr), colon != string::npos ? hostport.substr(colon) : "");
+  }
+};
+
 struct NetworkTerminalController : public TerminalControllerInterface {
   Connection *conn=0;
   Connection::CB detach_cb;
   Callback close_cb, success_cb;
   string remote, read_buf, ret_buf;
-  bool background_services=true, success_on_connect=false;
+  int read_pending=0;
+  bool background_services=true, success_on_connect=false, dropped=false;
   NetworkTerminalController(TerminalTabInterface *p, const string &r, const Callback &ccb) :
     TerminalControllerInterface(p), detach_cb(bind(&NetworkTerminalController::ConnectedCB, this)),
     close_cb(ccb), remote(r) {}
   virtual ~NetworkTerminalController() { close_cb=Callback(); Close(); }
   virtual int GetConnectionState() const { return conn ? conn->state : Connection::Error; }
+  virtual size_t GetWriteQueueSize() const { return conn ? conn->wb.size() : 0; }
 
   virtual Socket Open(TextArea *t) {
     if (remote.empty()) return InvalidSocket;
     t->Write(StrCat(LS("connecting_to"), " ", remote, "\r\n"));
     app->RunInNetworkThread([=](){
-      if (!(conn = app->ConnectTCP(remote, 0, &detach_cb, background_services)))
+      if (!(conn = app->ConnectTCP(Singleton<TerminalDNSCache>::Get()->Resolve(remote), 0, &detach_cb, background_services)))
         if (app->network_thread) app->RunInMainThread([=](){ Close(); }); });
     return app->network_thread ? InvalidSocket : (conn ? conn->GetSocket() : InvalidSocket);
   }
@@ -152,11 +198,12 @@ struct NetworkTerminalController : public TerminalControllerInterface {
       conn->SetError();
     }
     conn = 0;
+    read_pending = 0;
     if (close_cb) close_cb();
   }
 
   virtual void ConnectedCB() {
-    if (conn->state != Connection::Connected) { auto c=conn; Close(); return c->Close(); }
+    if (conn->state != Connection::Connected) { auto c=conn; dropped=true; Close(); return c->Close(); }
     parent->connected = Now();
     conn->AddToMainWait(parent->root, bind(&TerminalTabInterface::ControllerReadableCB, parent));
     if (success_on_connect && success_cb) success_cb();
@@ -164,12 +211,14 @@ struct NetworkTerminalController : public TerminalControllerInterface {
 
   virtual StringPiece Read() {
     if (!conn || conn->state != Connection::Connected) return StringPiece();
-    if (conn->Read() < 0) { ERROR(conn->Name(), ": Read"); Close(); return StringPiece(); }
-    read_buf.append(conn->rb.begin(), conn->rb.size());
-    conn->rb.Flush(conn->rb.size());
-    swap(read_buf, ret_buf);
-    read_buf.clear();
-    return ret_buf;
+    ReadConsumed();
+    if (conn->Read() < 0) { ERROR(conn->Name(), ": Read"); dropped=true; Close(); return StringPiece(); }
+    return StringPiece(conn->rb.begin(), (read_pending = conn->rb.size()));
+  }
+
+  virtual void ReadConsumed() {
+    if (conn && read_pending) conn->rb.Flush(read_pending);
+    read_pending = 0;
   }
 
   virtual int Write(const StringPiece &in) {
@@ -185,7 +234,7 @@ struct InteractiveTerminalController : public TerminalControllerInterface {
   Shell shell;
   UnbackedTextBox cmd;
   string buf, prompt="> ", header;
-  bool blocking=0, done=0;
+  bool blocking=0, done=0, pasting=0;
   char enter_char = '\r';
   unordered_map<string, Callback> escapes = {
     { "OA", bind([&] { cmd.HistUp();   WriteText(StrCat("\x0d", prompt, String::ToUTF8(cmd.cmd_line.Text16()), "\x1b[K")); }) },
@@ -208,60 +257,295 @@ struct InteractiveTerminalController : public TerminalControllerInterface {
 
   void IOCtlWindowSize(int w, int h) {}
   int Write(const StringPiece &buf) {
-    int l = buf.size();
-    const char *b = buf.data();
+    string out;
+    for (const char *b = buf.data(), *e = b + buf.size(); b < e; ++b) {
+      if (*b == '\x1b' && pasting) {
+        if (e - b >= 6 && !memcmp(b, "\x1b[201~", 6)) { pasting = false; b += 5; continue; }
+      } else if (*b == '\x1b' && e - b > 2 && (b[1] == 'O' || b[1] == '[')) {
+        const char *end = b + 3;
+        if (b[1] == '[') while (end <= e && (end[-1] < 0x40 || end[-1] > 0x7e)) end++;
+        string escape(b + 1, min(end, e) - b - 1);
+        b = min(end, e) - 1;
+        if (escape == "[200~") { pasting = true; continue; }
+        WriteText(out);
+        out.clear();
+        if (!FindAndDispatch(escapes, escape)) ERROR("unhandled escape: ", escape);
+        continue;
+      }
+
+      if (pasting && *b == '\r' && b + 1 < e && b[1] == '\n') continue;
+      bool cursor_last = cmd.cursor.i.x == cmd.cmd_line.Size();
+      if (*b == enter_char || (pasting && *b == '\n')) {
+        WriteText(out);
+        out.clear();
+        cmd.Enter();
+        out = "\r\n" + ((!done && !blocking) ? prompt : "");
+      }
+      else if (*b == 0x7f) { if (cmd.cursor.i.x) { out += (cursor_last ? "\b \b" : "\x08\x1b[1P"); cmd.Erase(); } }
+      else { out += (cursor_last ? "" : "\x1b[1@") + string(1, *b); cmd.Input(*b); }
+    }
+    WriteText(out);
+    return buf.size();
+  }
 
-    if (l > 1 && *b == '\x1b') {
-      string escape(b+1, l-1);
-      if (!FindAndDispatch(escapes, escape)) ERROR("unhandled escape: ", escape);
-      return l;
-    } else CHECK_EQ(1, l);
+  void WriteText(const StringPiece &b) { if (term && b.size()) term->Write(b); }
+};
 
-    bool cursor_last = cmd.cursor.i.x == cmd.cmd_line.Size();
-    if      (*b == enter_char) { if (1) { cmd.Enter(); WriteText("\r\n" + ((!done && !blocking) ? prompt : "")); } }
-    else if (*b == 0x7f)       { if (cmd.cursor.i.x) { WriteText((cursor_last ? "\b \b" : "\x08\x1b[1P"));        cmd.Erase();   } }
-    else                       { if (1)              { WriteText((cursor_last ? "" : "\x1b[1@") + string(1, *b)); cmd.Input(*b); } }
-    return l;
+struct TerminalRecordReader {
+  string filename;
+  unique_ptr<FlatFile> file;
+  z_stream zs;
+  string block;
+  vector<unsigned long long> block_stamps;
+  vector<unsigned> block_sizes;
+  size_t block_ind=0, block_offset=0;
+  TerminalRecordReader(const string &fn) : filename(fn), file(make_unique<FlatFile>(fn)) { memzero(zs); inflateInit(&zs); }
+  ~TerminalRecordReader() { inflateEnd(&zs); }
+
+  void Seek(unsigned long long offset) {
+    file = make_unique<FlatFile>(filename);
+    if (offset) file->file->Seek(offset, File::Whence::SET);
+    block_stamps.clear();
+    block_sizes.clear();
+    block_ind = block_offset = 0;
+    inflateReset(&zs);
   }
 
-  void WriteText(const StringPiece &b) { if (term) term->Write(b); }
+  bool Next(unsigned long long *stamp, string *data) {
+#ifdef LFL_FLATBUFFERS
+    while (block_ind >= block_sizes.size()) {
+      auto r = file->Next<LTerminal::RecordLog>();
+      if (!r) return false;
+      if (r->block_data()) { if (!ReadBlock(r)) return false; continue; }
+      *stamp = r->stamp();
+      if (r->data()) data->assign(MakeSigned(r->data()->data()), r->data()->size());
+      else data->clear();
+      return true;
+    }
+    *stamp = block_stamps[block_ind];
+    data->assign(block.data() + block_offset, block_sizes[block_ind]);
+    block_offset += block_sizes[block_ind++];
+    return true;
+#else
+    return false;
+#endif
+  }
+
+#ifdef LFL_FLATBUFFERS
+  bool ReadBlock(const LTerminal::RecordLog *r) {
+    auto stamps = r->block_stamps();
+    auto sizes = r->block_sizes();
+    if (!stamps || !sizes || stamps->size() != sizes->size()) return ERRORv(false, "bad block ", filename);
+    size_t total = 0;
+    block_stamps.resize(sizes->size());
+    block_sizes.resize(sizes->size());
+    for (size_t i = 0, l = sizes->size(); i != l; ++i) {
+      block_stamps[i] = r->stamp() + stamps->Get(i);
+      total += (block_sizes[i] = sizes->Get(i));
+    }
+    block.resize(total);
+    block_ind = block_offset = 0;
+    if (r->block_reset()) inflateReset(&zs);
+    zs.next_in = const_cast<Bytef*>(r->block_data()->data());
+    zs.avail_in = r->block_data()->size();
+    zs.next_out = MakeUnsigned(&block[0]);
+    zs.avail_out = total;
+    int ret = inflate(&zs, Z_SYNC_FLUSH);
+    if ((ret != Z_OK && ret != Z_BUF_ERROR) || zs.avail_out) return ERRORv(false, "inflate ", filename, ": ", ret);
+    return true;
+  }
+#endif
 };
 
 struct PlaybackTerminalController : public TerminalControllerInterface {
-  unique_ptr<FlatFile> playback;
-  PlaybackTerminalController(TerminalTabInterface *p, unique_ptr<FlatFile> f) :
-    TerminalControllerInterface(p), playback(move(f)) {}
-  Socket Open(TextArea*) { return InvalidSocket; }
-  int Write(const StringPiece &b) { return b.size(); }
-  StringPiece Read() {
+  struct Keyframe { unsigned long long stamp, offset; string snapshot; };
+  string filename;
+  TerminalRecordReader playback;
+  unique_ptr<TimerInterface> timer;
+  vector<Keyframe> index;
+  string read_buf, next_data;
+  unsigned long long next_stamp=0, first_stamp=0, last_stamp=0;
+  bool have_next=0, debug=0;
+  float speed=1;
+  int max_read_buf=1024*1024;
+  Time start=Time::zero();
+  PlaybackTerminalController(TerminalTabInterface *p, const string &fn, float s=1, bool d=0) :
+    TerminalControllerInterface(p), filename(fn), playback(fn), debug(d), speed(max(0.0f, s)) {}
+
+  Socket Open(TextArea*) {
 #ifdef LFL_FLATBUFFERS
-    auto r = playback ? playback->Next<LTerminal::RecordLog>() : nullptr;
-    auto ret = (r && r->data()) ? StringPiece(MakeSigned(r->data()->data()), r->data()->size()) : StringPiece();
-    unsigned long long stamp = r ? r->stamp() : 0;
-    fprintf(stderr, "Playback %llu \"%s\"\n", stamp, CHexEscapeNonAscii(ret).c_str());
-    return ret;
+    if ((have_next = NextRecord())) first_stamp = last_stamp = next_stamp;
+    FlatFile index_file(StrCat(filename, ".index"));
+    while (auto k = index_file.Next<LTerminal::RecordKeyframe>())
+      index.push_back({ k->stamp(), k->offset(), k->snapshot() ?
+                        string(MakeSigned(k->snapshot()->data()), k->snapshot()->size()) : string() });
+    start = Now();
+    timer = SystemToolkit::CreateTimer([=](){ if (parent->ControllerReadableCB()) parent->root->Wakeup(); });
+    if (have_next) timer->Run(Time(0), true);
 #else
     ERROR("Playback not supported");
-    return StringPiece();
+#endif
+    return InvalidSocket;
+  }
+
+  int Write(const StringPiece &b) { return b.size(); }
+
+  StringPiece Read() {
+    Time playback_time(Time::rep((Now() - start).count() * speed));
+    while (have_next && int(read_buf.size()) < max_read_buf && (!speed || NextRecordDue(playback_time))) {
+      if (debug) fprintf(stderr, "Playback %llu \"%s\"\n", next_stamp, CHexEscapeNonAscii(next_data).c_str());
+      read_buf.append(next_data);
+      last_stamp = next_stamp;
+      have_next = NextRecord();
+    }
+    if (have_next) timer->Run(speed ? Time(Time::rep((Time::rep(next_stamp - first_stamp) - playback_time.count()) / speed)) : Time(0), true);
+    return read_buf;
+  }
+
+  void ReadConsumed() { read_buf.clear(); }
+
+  Time Position() const { return Time(Time::rep(last_stamp - first_stamp)); }
+  void SeekBy(Time d) { Seek(Position() + d); }
+
+  void Seek(Time t) {
+#ifdef LFL_FLATBUFFERS
+    if (!timer) return;
+    unsigned long long target = first_stamp + max(Time::zero(), t).count();
+    auto k = upper_bound(index.begin(), index.end(), target,
+                         [](unsigned long long v, const Keyframe &k) { return v < k.stamp; });
+    if (k != index.begin()) {
+      playback.Seek((--k)->offset);
+      read_buf = k->snapshot;
+    } else {
+      playback.Seek(0);
+      read_buf = "\x1b[0m\x1b[H\x1b[2J";
+    }
+    for (have_next = NextRecord(); have_next && next_stamp < target; have_next = NextRecord())
+      read_buf.append(next_data);
+    last_stamp = target;
+    if (speed) start = Now() - Time(Time::rep((target - first_stamp) / speed));
+    timer->Run(Time(0), true);
 #endif
   }
+
+  bool NextRecordDue(Time playback_time) const { return Time::rep(next_stamp - first_stamp) <= playback_time.count(); }
+
+  bool NextRecord() { return playback.Next(&next_stamp, &next_data); }
 };
 
 #ifdef LFL_PTY
 struct ReadBuffer {
-  int size;
-  Time stamp;
   string data;
-  ReadBuffer(int S=0) : size(S), stamp(Now()), data(S, 0) {}
-  void Reset() { stamp=Now(); data.resize(size); }
+  size_t len=0, size, min_size, max_size;
+  int idle_reads=0, idle_shrink=64;
+  ReadBuffer(size_t S=0, size_t MS=0) : size(S), min_size(S), max_size(max(S, MS)) {}
+
+  bool Full() const { return len >= size; }
+  StringPiece Data() const { return StringPiece(data.data(), len); }
+  char *Space() {
+    if (data.size() < size) data.resize(size);
+    return &data[len];
+  }
+
+  void Consumed() {
+    if (Full()) { size = min(max_size, size * 2); idle_reads = 0; }
+    else if (len >= size / 4) idle_reads = 0;
+    else if (++idle_reads >= idle_shrink && size > min_size) {
+      size = max(min_size, size / 2);
+      string(data.data(), size).swap(data);
+      idle_reads = 0;
+    }
+    len = 0;
+  }
+};
+
+// Reads the PTY off the main thread. Network controllers don't use this: Connection::Read and
+// SSH decryption aren't thread safe, so telnet and SSH still recv on the main thread.
+struct TerminalReadThread {
+  Socket fd;
+  int notify[2] = { -1, -1 }, wake[2] = { -1, -1 }, taken = -1, fill = 0;
+  size_t max_buf, max_parse, taken_offset = 0, taken_len = 0;
+  string buf[2];
+  atomic<int> published{-1};
+  atomic<bool> done{false}, eof{false};
+  thread worker;
+  TerminalReadThread(Socket f, size_t mb=1024*1024, size_t mp=65536) : fd(f), max_buf(mb), max_parse(mp) {
+    CHECK_EQ(0, pipe(notify));
+    CHECK_EQ(0, pipe(wake));
+    fcntl(notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake[0], F_SETFL, O_NONBLOCK);
+    worker = thread(bind(&TerminalReadThread::Run, this));
+  }
+  ~TerminalReadThread() {
+    done = true;
+    Wake();
+    worker.join();
+    for (auto p : { notify[0], notify[1], wake[0], wake[1] }) close(p);
+  }
+
+  void Run() {
+    char chunk[16384];
+    while (!done) {
+      pollfd pfd[2] = { { wake[0], POLLIN, 0 }, { buf[fill].size() < max_buf ? fd : -1, POLLIN, 0 } };
+      if (poll(pfd, 2, -1) < 0) { if (errno == EINTR) continue; break; }
+      if (pfd[0].revents) Drain(wake[0]);
+      if (pfd[1].revents) {
+        int l = read(fd, chunk, sizeof(chunk));
+        if (l > 0) buf[fill].append(chunk, l);
+        else if (l == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) break;
+      }
+      Publish();
+    }
+    while (!done && buf[fill].size() && !Publish()) {
+      pollfd pfd = { wake[0], POLLIN, 0 };
+      if (poll(&pfd, 1, -1) > 0) Drain(wake[0]);
+    }
+    if (!done) { eof = true; Notify(); }
+  }
+
+  bool Publish() {
+    if (buf[fill].empty() || published.load(memory_order_acquire) >= 0) return false;
+    published.store(fill, memory_order_release);
+    fill ^= 1;
+    Notify();
+    return true;
+  }
+
+  void Notify() { char c = 0; if (write(notify[1], &c, 1) < 0) {} }
+  void Wake()   { char c = 0; if (write(wake[1],   &c, 1) < 0) {} }
+  static void Drain(int p) { char drain[64]; while (read(p, drain, sizeof(drain)) > 0) {} }
+
+  StringPiece Read() {
+    Drain(notify[0]);
+    if (taken < 0 && (taken = published.load(memory_order_acquire)) < 0) return StringPiece();
+    taken_len = min(max_parse, buf[taken].size() - taken_offset);
+    return StringPiece(buf[taken].data() + taken_offset, taken_len);
+  }
+
+  void Consumed() {
+    if (taken < 0) return;
+    if ((taken_offset += taken_len) < buf[taken].size()) return Notify();
+    buf[taken].clear();
+    taken = -1;
+    taken_offset = taken_len = 0;
+    published.store(-1, memory_order_release);
+    if (eof) Notify();
+    else Wake();
+  }
 };
 
 struct PTYTerminalController : public TerminalControllerInterface {
   Socket fd = -1;
   ProcessPipe process;
   ReadBuffer read_buf;
-  PTYTerminalController(TerminalTabInterface *p) : TerminalControllerInterface(p), read_buf(65536) {}
+  unique_ptr<TerminalReadThread> reader;
+  string write_buf;
+  size_t write_offset=0;
+  bool write_wait=0, threaded=0;
+  int max_reads=8;
+  PTYTerminalController(TerminalTabInterface *p) : TerminalControllerInterface(p), read_buf(16384, 1024*1024) {}
   virtual ~PTYTerminalController() {
+    StopReader();
     if (process.in) app->scheduler.DelMainWaitSocket(app->focused, fileno(process.in));
   }
 
@@ -271,10 +555,56 @@ struct PTYTerminalController : public TerminalControllerInterface {
     if (lang .empty()) setenv("LANG", "en_US.UTF-8", 1);
     const char *av[] = { shell.c_str(), 0 };
     CHECK_EQ(process.OpenPTY(av, app->startdir.c_str()), 0);
-    return (fd = fileno(process.out));
+    SystemNetwork::SetSocketBlocking((fd = fileno(process.out)), 0);
+    if (!threaded) return fd;
+    reader = make_unique<TerminalReadThread>(fd);
+    return reader->notify[0];
+  }
+
+  void StopReader() {
+    if (!reader) return;
+    app->scheduler.DelMainWaitSocket(parent->root, reader->notify[0]);
+    reader.reset();
+  }
+
+  size_t GetWriteQueueSize() const { return write_buf.size() - write_offset; }
+
+  int Write(const StringPiece &b) {
+    if (!process.in) return -1;
+    if (!GetWriteQueueSize()) {
+      int l = write(fd, b.data(), b.size());
+      if (l < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return ERRORv(-1, "PTYTerminalController write");
+      if ((l = max(0, l)) == int(b.size())) return l;
+      write_buf.assign(b.data() + l, b.size() - l);
+      write_offset = 0;
+    } else write_buf.append(b.data(), b.size());
+    UpdateWriteWait();
+    return b.size();
+  }
+
+  bool FlushWriteQueue() {
+    while (GetWriteQueueSize()) {
+      int l = write(fd, write_buf.data() + write_offset, GetWriteQueueSize());
+      if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+      if (l <= 0) { ERROR("PTYTerminalController write"); write_buf.clear(); write_offset = 0; break; }
+      write_offset += l;
+    }
+    if (!GetWriteQueueSize()) { write_buf.clear(); write_offset = 0; }
+    UpdateWriteWait();
+    return parent->ControllerReadableCB();
   }
 
-  int Write(const StringPiece &b) { return write(fd, b.data(), b.size()); }
+  void UpdateWriteWait() {
+    bool wait = GetWriteQueueSize();
+    if (wait == write_wait || !process.in) return;
+    if (write_wait || !reader) app->scheduler.DelMainWaitSocket(parent->root, fd);
+    if ((write_wait = wait))
+      app->scheduler.AddMainWaitSocket(parent->root, fd, (reader ? 0 : SocketSet::READABLE) | SocketSet::WRITABLE,
+                                       bind(&PTYTerminalController::FlushWriteQueue, this));
+    else if (!reader)
+      app->scheduler.AddMainWaitSocket(parent->root, fd, SocketSet::READABLE,
+                                       bind(&TerminalTabInterface::ControllerReadableCB, parent));
+  }
   void IOCtlWindowSize(int w, int h) {
     struct winsize ws;
     memzero(ws);
@@ -285,43 +615,178 @@ struct PTYTerminalController : public TerminalControllerInterface {
 
   StringPiece Read() {
     if (!process.in) return StringPiece();
-    read_buf.Reset();
-    if (NBRead(fd, &read_buf.data) < 0) { ERROR("PTYTerminalController read"); Close(); return ""; }
-    return read_buf.data;
+    if (reader) {
+      StringPiece ret = reader->Read();
+      if (ret.empty() && reader->eof) { ERROR("PTYTerminalController read"); Close(); }
+      return ret;
+    }
+    for (int i = 0; i < max_reads && !read_buf.Full(); i++) {
+      int l = read(fd, read_buf.Space(), read_buf.size - read_buf.len);
+      if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) break;
+      if (l <= 0) { ERROR("PTYTerminalController read"); Close(); break; }
+      read_buf.len += l;
+    }
+    return read_buf.Data();
   }
 
+  void ReadConsumed() { if (reader) reader->Consumed(); else read_buf.Consumed(); }
+
   void Close() {
+    StopReader();
     if (process.in) {
       app->scheduler.DelMainWaitSocket(app->focused, fileno(process.in));
       process.Close();
     }
+    write_buf.clear();
+    write_offset = 0;
   }
 };
 #endif // LFL_PTY
 
 #ifdef LFL_CRYPTO
+inline bool SocketWouldBlock() {
+#ifdef WIN32
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+struct TerminalLocalEcho {
+  string pending, out;
+  int displayed=0, escape=0;
+  point start;
+  bool confirmed=false;
+
+  void Typed(const StringPiece &b, const point &cursor, int width) {
+    for (const char *c = b.data(); !b.Done(c); ++c) {
+      if (escape) { SkipEscape(*c); continue; }
+      if (*c == '\x1b') { escape = 1; continue; }
+      if (*c < 0x20 || *c > 0x7e) { confirmed = false; continue; }
+      pending.append(1, *c);
+      if (!confirmed || displayed + 1 != int(pending.size())) continue;
+      if (!displayed) start = cursor;
+      if (start.x + displayed > width) continue;
+      StrAppend(&out, "\x1b[4m", string(1, *c), "\x1b[24m");
+      displayed++;
+    }
+  }
+
+  // Terminal replies like DA and DSR never echo, so escape sequences aren't predicted, but the
+  // cursor and editing keys move the remote cursor, which ends prediction until the next echo.
+  void SkipEscape(char c) {
+    if (escape == 1 && (c == '[' || c == 'O')) { escape = c == '[' ? 2 : 3; return; }
+    if (escape == 2 && (c < 0x40 || c > 0x7e)) return;
+    if (escape == 1 || (c && strchr("ABCDHF~", c))) confirmed = false;
+    escape = 0;
+  }
+
+  void Output(string *data, const point &cursor, int width) {
+    if (data->empty()) return;
+    size_t matched = 0, size = data->size(), limit = min(size, pending.size());
+    while (matched < limit && (*data)[matched] == pending[matched]) matched++;
+    if (pending.size()) {
+      if ((confirmed = matched && matched == limit)) pending.erase(0, matched);
+      else pending.clear();
+    }
+    point echo_start = displayed ? start : cursor;
+    if (displayed) {
+      string home = StrCat("\x1b[", start.y, ";", start.x, "H");
+      data->insert(0, StrCat(home, string(displayed, ' '), home));
+    }
+    displayed = 0;
+    if (confirmed && limit < size) pending.clear();
+    else if (confirmed && pending.size() && echo_start.x + int(size) <= width) {
+      start = point(echo_start.x + size, echo_start.y);
+      displayed = min(int(pending.size()), width - start.x + 1);
+      StrAppend(data, "\x1b[4m", pending.substr(0, displayed), "\x1b[24m");
+    }
+  }
+};
+
 struct SSHTerminalController : public NetworkTerminalController {
+  struct ForwardStats {
+    long long bytes_in=0, bytes_out=0, window_in=0, window_out=0, rate_in=0, rate_out=0;
+    Time window_start=Time::zero(), ttfb_total=Time::zero();
+    int ttfb_count=0;
+
+    void Add(long long in, long long out, Time now) {
+      if (now - window_start >= Seconds(1)) {
+        long long window_ms = max<long long>(1000, (now - window_start).count());
+        rate_in  = window_in  * 1000 / window_ms;
+        rate_out = window_out * 1000 / window_ms;
+        window_in = window_out = 0;
+        window_start = now;
+      }
+      bytes_in  += in;  window_in  += in;
+      bytes_out += out; window_out += out;
+    }
+
+    void AddTTFB(Time t) { ttfb_total += t; ttfb_count++; }
+    long long RateIn (Time now) const { return now - window_start < Seconds(2) ? rate_in  : 0; }
+    long long RateOut(Time now) const { return now - window_start < Seconds(2) ? rate_out : 0; }
+    Time TTFB() const { return ttfb_count ? Time(ttfb_total.count() / ttfb_count) : Time::zero(); }
+  };
+
+  struct Forward : public ForwardStats {
+    bool remote, dynamic=0;
+    int port, target_port, backlog, active=0;
+    string target_host;
+    long long accepted=0;
+    Forward(bool r=0, int p=0, const string &th="", int tp=0, int b=0) : remote(r), port(p), target_port(tp), backlog(b), target_host(th) {}
+  };
+
   struct RemoteForwardConnectionData : public Connection::Data {
     SSHClient::Channel *chan;
-    RemoteForwardConnectionData(SSHClient::Channel *c=0) : chan(c) {}
+    Forward *forward;
+    RemoteForwardConnectionData(SSHClient::Channel *c=0, Forward *f=0) : chan(c), forward(f) {}
+  };
+
+  struct ForwardSocket : public ForwardStats {
+    SSHClient::Channel *chan;
+    string write_buf;
+    size_t write_offset=0;
+    int read_size, wait_flags=0;
+    bool closing=0;
+    Forward *forward=0;
+    Time opened=Now(), ttfb=Time::zero();
+    string origin_host, target, socks_buf;
+    int origin_port=0, socks_state=0;
+    ForwardSocket(SSHClient::Channel *c=0, int rs=0) : chan(c), read_size(rs) {}
+    bool WriteQueued() const { return write_offset < write_buf.size(); }
+    size_t WriteQueueSize() const { return write_buf.size() - write_offset; }
   };
   
+  enum { SOCKSGreeting=1, SOCKSRequest=2, SOCKSConnect=3 };
   typedef function<void(int, const string&)> SavehostCB;
   SSHClient::Params params;
   SavehostCB savehost_cb;
   Connection::CB remote_forward_detach_cb;
   SSHClient::FingerprintCB fingerprint_cb;
   SSHClient::LoadIdentityCB identity_cb;
+  shared_ptr<SSHClient::Identity> loaded_identity;
+  Callback login_cb;
+  bool logged_in=0;
   string fingerprint, password;
   int fingerprint_type=0;
   unordered_set<Socket> forward_fd;
+  unordered_map<Socket, ForwardSocket> forward_sockets;
+  unordered_map<Socket, Forward> local_forwards;
+  unordered_map<string, Forward> remote_forwards;
+  unordered_map<int, int> forward_backlog;
+  vector<int> forward_dynamic;
+  int default_forward_backlog=16;
+  string forward_read_buf;
+  int forward_min_read=16384, forward_max_read=262144, forward_read_budget=262144;
+  size_t forward_write_high_water=1024*1024, forward_write_max=16*1024*1024;
   AlertViewInterface *passphrase_alert=0;
+  Terminal *term=0;
+  unique_ptr<TerminalLocalEcho> local_echo;
+  string echo_buf;
 
   SSHTerminalController(TerminalTabInterface *p, SSHClient::Params a, const Callback &ccb) :
     NetworkTerminalController(p, a.hostport, ccb), params(move(a)),
-    remote_forward_detach_cb(bind(&SSHTerminalController::RemotePortForwardConnectCB, this, _1)) {
-    for (auto &f : params.forward_local) ForwardLocalPort(f.port, f.target_host, f.target_port);
-  }
+    remote_forward_detach_cb(bind(&SSHTerminalController::RemotePortForwardConnectCB, this, _1)) {}
 
   virtual ~SSHTerminalController() {
     for (auto &fd : forward_fd) {
@@ -331,14 +796,18 @@ struct SSHTerminalController : public NetworkTerminalController {
   }
 
   Socket Open(TextArea *t) {
-    Terminal *term = dynamic_cast<Terminal*>(t);
+    term = dynamic_cast<Terminal*>(t);
+    for (auto &f : params.forward_local) ForwardLocalPort(f.port, f.target_host, f.target_port);
+    for (auto &p : forward_dynamic) ForwardDynamicPort(p);
     SSHReadCB(0, StrCat(LS("connecting_to"), " ", params.user, params.user.size() ? "@" : "", params.hostport, "\r\n"));
     params.background_services = background_services;
     app->RunInNetworkThread([=](){
+      SSHClient::Params connect_params = params;
+      connect_params.hostport = Singleton<TerminalDNSCache>::Get()->Resolve(params.hostport);
       success_cb = bind(&SSHTerminalController::SSHLoginCB, this, term);
-      conn = SSHClient::Open(app, params, SSHClient::ResponseCB
+      conn = SSHClient::Open(app, connect_params, SSHClient::ResponseCB
                              (bind(&SSHTerminalController::SSHReadCB, this, _1, _2)), &detach_cb, &success_cb);
-      if (!conn) { app->RunInMainThread(bind(&NetworkTerminalController::Dispose, this)); return; }
+      if (!conn) { dropped = true; app->RunInMainThread(bind(&NetworkTerminalController::Dispose, this)); return; }
       SSHClient::SetTerminalWindowSize(conn, term->term_width, term->term_height);
       SSHClient::SetCredentialCB(conn, bind(&SSHTerminalController::FingerprintCB, this, _1, _2),
                                  bind(&SSHTerminalController::LoadIdentityCB, this, _1),
@@ -355,7 +824,11 @@ struct SSHTerminalController : public NetworkTerminalController {
     return fingerprint_cb ? fingerprint_cb(fingerprint_type, fingerprint) : true;
   }
 
-  bool LoadIdentityCB(shared_ptr<SSHClient::Identity> *out) { return identity_cb ? identity_cb(out) : true; }
+  bool LoadIdentityCB(shared_ptr<SSHClient::Identity> *out) {
+    bool ret = identity_cb ? identity_cb(out) : true;
+    if (ret && *out) loaded_identity = *out;
+    return ret;
+  }
   bool LoadPasswordCB(string *out) {
     if (password.size()) { out->clear(); swap(*out, password); return true; }
     else {
@@ -367,6 +840,8 @@ struct SSHTerminalController : public NetworkTerminalController {
 
   void SSHLoginCB(Terminal *term) {
     SSHReadCB(0, StrCat(LS("connected"), ".\r\n"));
+    logged_in = true;
+    if (login_cb) login_cb();
     if (savehost_cb) savehost_cb(fingerprint_type, fingerprint);
   }
 
@@ -383,94 +858,355 @@ struct SSHTerminalController : public NetworkTerminalController {
     char buf[1];
     if (!conn || conn->state != Connection::Connected) return -1;
     StringPiece b = GetMetaModified(in, buf);
-    return SSHClient::WriteChannelData(conn, b);
+    int ret = SSHClient::WriteChannelData(conn, b);
+    if (local_echo && term && ret > 0) {
+      local_echo->Typed(b, term->term_cursor, term->term_width);
+      if (local_echo->out.size()) parent->ControllerReadableCB();
+    }
+    return ret;
   }
 
   StringPiece Read() {
     if (conn && conn->state == Connection::Connected) {
-      if (conn->Read() < 0)                                 { ERROR(conn->Name(), ": Read");       Close(); return ""; }
-      if (conn->rb.size() && conn->handler->Read(conn) < 0) { ERROR(conn->Name(), ": query read"); Close(); return ""; }
+      if (conn->Read() < 0) { ERROR(conn->Name(), ": Read"); dropped=true; Close(); return ""; }
+      if (conn->rb.size()) {
+        if (conn->handler->Read(conn) < 0) { ERROR(conn->Name(), ": query read"); Close(); return ""; }
+        UpdatePausedForwardSockets();
+      }
     }
     swap(read_buf, ret_buf);
     read_buf.clear();
-    return ret_buf;
+    if (!local_echo || !term) return ret_buf;
+    echo_buf = ret_buf;
+    local_echo->Output(&echo_buf, term->term_cursor, term->term_width);
+    echo_buf.append(local_echo->out);
+    local_echo->out.clear();
+    return echo_buf;
+  }
+
+  StringPiece RecordData(const StringPiece &b) { return local_echo ? StringPiece(ret_buf) : b; }
+
+  bool ForwardDynamicPort(int port) {
+    if (!ForwardLocalPort(port, "", 0)) return false;
+    for (auto &i : local_forwards) if (i.second.port == port) i.second.dynamic = true;
+    return true;
   }
 
   bool ForwardLocalPort(int port, const string &target_h, int target_p) {
-    Socket fd = SystemNetwork::Listen(Protocol::TCP, IPV4::Parse("127.0.0.1"), port, 1, false);
+    auto b = forward_backlog.find(port);
+    int backlog = (b != forward_backlog.end() && b->second > 0) ? b->second : default_forward_backlog;
+    Socket fd = SystemNetwork::Listen(Protocol::TCP, IPV4::Parse("127.0.0.1"), port, backlog, false);
     if (fd == InvalidSocket) return ERRORv(false, "listen ", port);
+    SystemNetwork::SetSocketBlocking(fd, 0);
+    local_forwards[fd] = Forward(false, port, target_h, target_p, backlog);
     app->scheduler.AddMainWaitSocket
-      (parent->root, fd, SocketSet::READABLE, bind(&SSHTerminalController::LocalPortForwardAcceptCB, this, fd, target_h, target_p));
+      (parent->root, fd, SocketSet::READABLE, bind(&SSHTerminalController::LocalPortForwardAcceptCB, this, fd));
     forward_fd.insert(fd);
     return true;
   }
 
-  bool LocalPortForwardAcceptCB(Socket listen_fd, const string &target_h, int target_p) {
-    int accept_port = 0;
-    IPV4::Addr accept_addr = 0;
-    Socket fd = SystemNetwork::Accept(listen_fd, &accept_addr, &accept_port);
-    if (!conn || conn->state != Connection::Connected) { SystemNetwork::CloseSocket(fd); return ERRORv(false, "no conn"); }
-    SSHClient::Channel *chan = SSHClient::OpenTCPChannel
-      (conn, IPV4::Text(accept_addr), accept_port, target_h, target_p,
-       bind(&SSHTerminalController::PortForwardRemoteReadCB, this, fd, _1, _2, _3));
-    if (!chan) { SystemNetwork::CloseSocket(fd); return ERRORv(false, "open chan"); } 
-    app->scheduler.AddMainWaitSocket
-      (parent->root, fd, SocketSet::READABLE, bind(&SSHTerminalController::PortForwardLocalReadCB, this, fd, chan));
-    forward_fd.insert(fd);
+  bool LocalPortForwardAcceptCB(Socket listen_fd) {
+    auto it = local_forwards.find(listen_fd);
+    if (it == local_forwards.end()) return false;
+    Forward *lf = &it->second;
+    for (int i = 0; i < lf->backlog; i++) {
+      int accept_port = 0;
+      IPV4::Addr accept_addr = 0;
+      Socket fd = SystemNetwork::Accept(listen_fd, &accept_addr, &accept_port);
+      if (fd == InvalidSocket) break;
+      if (!conn || conn->state != Connection::Connected) { SystemNetwork::CloseSocket(fd); ERROR("no conn"); continue; }
+      if (lf->dynamic) {
+        ForwardSocket *f = AddForwardSocket(fd, nullptr, SOCKSGreeting);
+        f->forward = lf;
+        f->origin_host = IPV4::Text(accept_addr);
+        f->origin_port = accept_port;
+        lf->active++;
+        lf->accepted++;
+        continue;
+      }
+      SSHClient::Channel *chan = SSHClient::OpenTCPChannel
+        (conn, IPV4::Text(accept_addr), accept_port, lf->target_host, lf->target_port,
+         bind(&SSHTerminalController::PortForwardRemoteReadCB, this, fd, _1, _2, _3));
+      if (!chan) { SystemNetwork::CloseSocket(fd); ERROR("open chan"); continue; }
+      ForwardSocket *f = AddForwardSocket(fd, chan);
+      f->forward = lf;
+      f->origin_host = IPV4::Text(accept_addr);
+      f->origin_port = accept_port;
+      lf->active++;
+      lf->accepted++;
+      INFO("Forward ", lf->port, " -> ", lf->target_host, ":", lf->target_port, " accepted ", IPV4::Text(accept_addr), ":",
+           accept_port, ", ", lf->active, " active, ", lf->accepted, " total");
+    }
     return false;
   }
 
+  static string ForwardBytes(long long n) {
+    if (n < 1024)      return StrCat(n, "B");
+    if (n < 1024*1024) return StringPrintf("%.1fK", n / 1024.0);
+    return StringPrintf("%.1fM", n / (1024.0*1024));
+  }
+
+  static string ForwardStatsLine(const ForwardStats &s, Time now) {
+    return StrCat("in ", ForwardBytes(s.bytes_in), " (", ForwardBytes(s.RateIn(now)), "/s) out ", ForwardBytes(s.bytes_out),
+                  " (", ForwardBytes(s.RateOut(now)), "/s) ttfb ", s.TTFB().count(), "ms");
+  }
+
+  string ForwardReport() const {
+    string ret;
+    Time now = Now();
+    for (auto &i : local_forwards)  ForwardReportSection(&ret, i.second, now);
+    for (auto &i : remote_forwards) ForwardReportSection(&ret, i.second, now);
+    return ret;
+  }
+
+  void ForwardReportSection(string *out, const Forward &f, Time now) const {
+    size_t queued = 0;
+    for (auto &s : forward_sockets) if (s.second.forward == &f) queued += s.second.WriteQueueSize();
+    StrAppend(out, f.remote ? "R " : (f.dynamic ? "D " : "L "), f.port, " -> ",
+              f.dynamic ? "socks5" : StrCat(f.target_host, ":", f.target_port), ": ", f.active, " open, ",
+              f.accepted, " total, queue ", ForwardBytes(queued), ", ", ForwardStatsLine(f, now), "\r\n");
+    for (auto &s : forward_sockets)
+      if (s.second.forward == &f)
+        StrAppend(out, "  #", s.first, s.second.target.size() ? StrCat(" ", s.second.target) : "", " age ", (now - s.second.opened).count() / 1000, "s queue ", ForwardBytes(s.second.WriteQueueSize()),
+                  ", ", ForwardStatsLine(s.second, now), "\r\n");
+  }
+
+  string ForwardSummary() const {
+    int open = 0;
+    long long rate = 0;
+    Time now = Now();
+    for (auto &i : local_forwards)  { open += i.second.active; rate += i.second.RateIn(now) + i.second.RateOut(now); }
+    for (auto &i : remote_forwards) { open += i.second.active; rate += i.second.RateIn(now) + i.second.RateOut(now); }
+    if (local_forwards.empty() && remote_forwards.empty()) return "";
+    return StrCat(local_forwards.size() + remote_forwards.size(), " ", LS("forwards"), ", ", open, " ", LS("open"), ", ",
+                  ForwardBytes(rate), "/s");
+  }
+
+  void CountForwardSocket(ForwardSocket *f, long long in, long long out) {
+    Time now = Now();
+    if (out && f->ttfb == Time::zero()) {
+      f->ttfb = max(Time(1), Time(now - f->opened));
+      f->AddTTFB(f->ttfb);
+      if (f->forward) f->forward->AddTTFB(f->ttfb);
+    }
+    f->Add(in, out, now);
+    if (f->forward) f->forward->Add(in, out, now);
+  }
+
+  void EraseForwardSocket(Socket fd) {
+    auto f = forward_sockets.find(fd);
+    if (f == forward_sockets.end()) return;
+    if (f->second.forward) f->second.forward->active--;
+    forward_sockets.erase(f);
+  }
+
   void RemotePortForwardAcceptCB(SSHClient::Channel *chan, const string &target_h, int target_p,
                                  const string &local_h, int local_p) {
     INFO("Forwarding ", local_h, ":", local_p, " -> ", target_h, ":", target_p);
+    string key = StrCat(local_p, ":", target_h, ":", target_p);
+    auto it = remote_forwards.find(key);
+    if (it == remote_forwards.end()) it = remote_forwards.emplace(key, Forward(true, local_p, target_h, target_p)).first;
+    Forward *forward = &it->second;
+    forward->accepted++;
     chan->cb = bind(&SSHTerminalController::PortForwardRemoteReadCB, this, 0, _1, _2, _3);
     app->RunInNetworkThread([=](){
       if (auto c = app->ConnectTCP(target_h, target_p, &remote_forward_detach_cb, false))
-        c->data = make_unique<RemoteForwardConnectionData>(chan);
+        c->data = make_unique<RemoteForwardConnectionData>(chan, forward);
     });
   }
 
   void RemotePortForwardConnectCB(Connection *c) {
     unique_ptr<SocketConnection> conn(dynamic_cast<SocketConnection*>(c));
     Socket fd = conn->socket;
-    auto chan = dynamic_cast<RemoteForwardConnectionData*>(conn->data.get())->chan;
+    auto data = dynamic_cast<RemoteForwardConnectionData*>(conn->data.get());
+    auto chan = data->chan;
     chan->cb = bind(&SSHTerminalController::PortForwardRemoteReadCB, this, fd, _1, _2, _3);
-    app->scheduler.AddMainWaitSocket
-      (parent->root, fd, SocketSet::READABLE, bind(&SSHTerminalController::PortForwardLocalReadCB, this, fd, chan));
-    forward_fd.insert(fd);
+    ForwardSocket *f = AddForwardSocket(fd, chan);
+    if ((f->forward = data->forward)) f->forward->active++;
     if (chan->buf.size()) {
-      if (::send(fd, chan->buf.data(), chan->buf.size(), 0) != chan->buf.size()) PortForwardLocalCloseCB(fd, chan);
+      if (!PortForwardLocalWrite(fd, f, chan->buf)) PortForwardLocalCloseCB(fd, chan);
       chan->buf.clear();
     }
   }
 
-  bool PortForwardLocalReadCB(Socket fd, SSHClient::Channel *chan) {
-    string buf(4096, 0);
-    int l = ::recv(fd, &buf[0], buf.size(), 0);
-    if (l <= 0) { PortForwardLocalCloseCB(fd, chan); return false; }
-    buf.resize(l);
-    if (!chan->opened) chan->buf.append(buf);
-    else if (!SSHClient::WriteToChannel(conn, chan, buf)) ERROR(conn->Name(), ": write");
+  ForwardSocket *AddForwardSocket(Socket fd, SSHClient::Channel *chan, int socks_state=0) {
+    SystemNetwork::SetSocketBlocking(fd, 0);
+    ForwardSocket *f = &(forward_sockets[fd] = ForwardSocket(chan, forward_min_read));
+    f->socks_state = socks_state;
+    UpdateForwardSocketWait(fd, f);
+    forward_fd.insert(fd);
+    return f;
+  }
+
+  int ForwardSocketWaitFlags(const ForwardSocket &f) const {
+    if (!f.chan) return (f.closing ? 0 : SocketSet::READABLE) | (f.WriteQueued() ? SocketSet::WRITABLE : 0);
+    bool readable = !f.closing && f.write_buf.size() - f.write_offset < forward_write_high_water &&
+      (f.chan->opened ? f.chan->window_s > 0 : f.chan->buf.size() < forward_write_high_water);
+    return (readable ? SocketSet::READABLE : 0) | (f.WriteQueued() ? SocketSet::WRITABLE : 0);
+  }
+
+  void UpdateForwardSocketWait(Socket fd, ForwardSocket *f) {
+    int wait_flags = ForwardSocketWaitFlags(*f);
+    if (wait_flags == f->wait_flags) return;
+    if (f->wait_flags) app->scheduler.DelMainWaitSocket(parent->root, fd);
+    if ((f->wait_flags = wait_flags))
+      app->scheduler.AddMainWaitSocket
+        (parent->root, fd, wait_flags, bind(&SSHTerminalController::PortForwardLocalReadyCB, this, fd));
+  }
+
+  void UpdatePausedForwardSockets() {
+    for (auto &f : forward_sockets)
+      if (!(f.second.wait_flags & SocketSet::READABLE)) UpdateForwardSocketWait(f.first, &f.second);
+  }
+
+  bool PortForwardLocalReadyCB(Socket fd) {
+    auto it = forward_sockets.find(fd);
+    if (it == forward_sockets.end()) return false;
+    ForwardSocket *f = &it->second;
+    SSHClient::Channel *chan = f->chan;
+    if (f->WriteQueued() && !PortForwardLocalFlush(fd, f)) { PortForwardLocalCloseCB(fd, chan); return false; }
+    if (f->closing) { if (!f->WriteQueued()) PortForwardRemoteCloseCB(fd, chan); return false; }
+    if (!chan) return PortForwardSOCKSReadCB(fd, f);
+
+    for (int budget = forward_read_budget; budget > 0 && (ForwardSocketWaitFlags(*f) & SocketSet::READABLE); ) {
+      int read_size = chan->opened ? min(f->read_size, chan->window_s) : f->read_size;
+      string *buf = chan->opened ? &forward_read_buf : &chan->buf;
+      size_t offset = chan->opened ? 0 : buf->size();
+      if (buf->size() < offset + read_size) buf->resize(offset + read_size);
+      int l = ::recv(fd, &(*buf)[offset], read_size, 0);
+      if (!chan->opened) buf->resize(offset + max(0, l));
+      if (l < 0 && SocketWouldBlock()) break;
+      if (l <= 0) { PortForwardLocalCloseCB(fd, chan); return false; }
+      CountForwardSocket(f, l, 0);
+      if (chan->opened && !SSHClient::WriteToChannel(conn, chan, StringPiece(buf->data(), l))) ERROR(conn->Name(), ": write");
+      if      (l == f->read_size)     f->read_size = min(forward_max_read, f->read_size * 2);
+      else if (l <  f->read_size / 4) f->read_size = max(forward_min_read, f->read_size / 2);
+      if (l < read_size) break;
+      budget -= l;
+    }
+    UpdateForwardSocketWait(fd, f);
+    return false;
+  }
+
+  bool PortForwardSOCKSReadCB(Socket fd, ForwardSocket *f) {
+    char buf[512];
+    int l = ::recv(fd, buf, sizeof(buf), 0);
+    if (l < 0 && SocketWouldBlock()) return false;
+    if (l <= 0 || f->socks_buf.size() + l > 1024) { PortForwardLocalCloseCB(fd, nullptr); return false; }
+    f->socks_buf.append(buf, l);
+    const unsigned char *b = MakeUnsigned(f->socks_buf.data());
+    size_t len = f->socks_buf.size();
+
+    if (f->socks_state == SOCKSGreeting) {
+      if (len < 2 || len < 2 + size_t(b[1])) return false;
+      if (b[0] != 5) { PortForwardLocalCloseCB(fd, nullptr); return ERRORv(false, "forward ", fd, " socks version ", int(b[0])); }
+      bool noauth = memchr(b + 2, 0, b[1]) != nullptr;
+      bool wrote = PortForwardLocalWrite(fd, f, StringPiece(noauth ? "\x05\x00" : "\x05\xff", 2), false);
+      if (!wrote || !noauth) { PortForwardLocalCloseCB(fd, nullptr); return false; }
+      f->socks_buf.erase(0, 2 + b[1]);
+      f->socks_state = SOCKSRequest;
+      b = MakeUnsigned(f->socks_buf.data());
+      len = f->socks_buf.size();
+    }
+
+    if (len < 5) return false;
+    int addr_len = b[3] == 1 ? 4 : (b[3] == 3 ? 1 + b[4] : (b[3] == 4 ? 16 : -1));
+    if (b[0] != 5 || b[1] != 1 || addr_len < 0) {
+      PortForwardSOCKSReply(fd, f, b[1] != 1 ? 7 : 8);
+      PortForwardLocalCloseCB(fd, nullptr);
+      return false;
+    }
+    if (int(len) < 4 + addr_len + 2) return false;
+
+    string target_h;
+    if (b[3] == 1) {
+      IPV4::Addr addr;
+      memcpy(&addr, b + 4, sizeof(addr));
+      target_h = IPV4::Text(addr);
+    }
+    else if (b[3] == 3) target_h = string(reinterpret_cast<const char*>(b + 5), b[4]);
+    else for (int i = 0; i < 16; i += 2) StrAppend(&target_h, i ? ":" : "", StringPrintf("%x", b[4+i] << 8 | b[4+i+1]));
+    int target_p = b[4 + addr_len] << 8 | b[4 + addr_len + 1];
+
+    SSHClient::Channel *chan = (conn && conn->state == Connection::Connected) ? SSHClient::OpenTCPChannel
+      (conn, f->origin_host, f->origin_port, target_h, target_p,
+       bind(&SSHTerminalController::PortForwardRemoteReadCB, this, fd, _1, _2, _3)) : nullptr;
+    if (!chan) { PortForwardSOCKSReply(fd, f, 1); PortForwardLocalCloseCB(fd, nullptr); return ERRORv(false, "open chan"); }
+    INFO("Forward ", f->forward->port, " -> ", target_h, ":", target_p, " socks ", f->origin_host, ":", f->origin_port);
+    chan->buf.append(f->socks_buf.data() + 4 + addr_len + 2, len - (4 + addr_len + 2));
+    string().swap(f->socks_buf);
+    f->target = StrCat(target_h, ":", target_p);
+    f->chan = chan;
+    f->socks_state = SOCKSConnect;
+    UpdateForwardSocketWait(fd, f);
     return false;
   }
 
+  void PortForwardSOCKSReply(Socket fd, ForwardSocket *f, int status) {
+    char reply[] = { 5, char(status), 0, 1, 0, 0, 0, 0, 0, 0 };
+    if (!PortForwardLocalWrite(fd, f, StringPiece(reply, sizeof(reply)), false)) ERROR("forward ", fd, " socks reply");
+  }
+
+  bool PortForwardLocalWrite(Socket fd, ForwardSocket *f, const StringPiece &b, bool count=true) {
+    size_t len = max(0, b.size());
+    if (count) CountForwardSocket(f, 0, len);
+    if (f->WriteQueued()) {
+      if (f->write_buf.size() - f->write_offset + len > forward_write_max)
+        return ERRORv(false, "forward ", fd, " write queue exceeded ", forward_write_max);
+      f->write_buf.append(b.data(), len);
+    } else {
+      int l = ::send(fd, b.data(), len, 0);
+      if (l < 0 && !SocketWouldBlock()) return false;
+      size_t sent = max(0, l);
+      if (sent == len) return true;
+      f->write_buf.assign(b.data() + sent, len - sent);
+      f->write_offset = 0;
+    }
+    UpdateForwardSocketWait(fd, f);
+    return true;
+  }
+
+  bool PortForwardLocalFlush(Socket fd, ForwardSocket *f) {
+    int l = ::send(fd, f->write_buf.data() + f->write_offset, f->write_buf.size() - f->write_offset, 0);
+    if (l < 0 && !SocketWouldBlock()) return false;
+    if (l > 0 && (f->write_offset += l) == f->write_buf.size()) { f->write_buf.clear(); f->write_offset = 0; }
+    else if (f->write_offset > f->write_buf.size() / 2) { f->write_buf.erase(0, f->write_offset); f->write_offset = 0; }
+    UpdateForwardSocketWait(fd, f);
+    return true;
+  }
+
   void PortForwardLocalCloseCB(Socket fd, SSHClient::Channel *chan) {
-    if (!SSHClient::CloseChannel(conn, chan)) ERROR(conn->Name(), ": write");
+    if (chan && !SSHClient::CloseChannel(conn, chan)) ERROR(conn->Name(), ": write");
     app->scheduler.DelMainWaitSocket(parent->root, fd);
     SystemNetwork::CloseSocket(fd);
     forward_fd.erase(fd);
+    EraseForwardSocket(fd);
   }
 
   int PortForwardRemoteReadCB(Socket fd, Connection*, SSHClient::Channel *chan, const StringPiece &b) {
-    if (!chan->opened) PortForwardRemoteCloseCB(fd, chan);
-    else if (!b.len) {
+    if (!chan->opened) {
+      auto f = forward_sockets.find(fd);
+      if (f != forward_sockets.end() && f->second.socks_state == SOCKSConnect) PortForwardSOCKSReply(fd, &f->second, 5);
+      PortForwardRemoteCloseCB(fd, chan);
+    } else if (!b.len) {
       if (chan->buf.size()) {
         if (!SSHClient::WriteToChannel(conn, chan, chan->buf)) return ERRORv(0, conn->Name(), ": write");
         chan->buf.clear();
       }
+      auto f = forward_sockets.find(fd);
+      if (f != forward_sockets.end()) {
+        if (f->second.socks_state == SOCKSConnect) {
+          f->second.socks_state = 0;
+          PortForwardSOCKSReply(fd, &f->second, 0);
+        }
+        UpdateForwardSocketWait(fd, &f->second);
+      }
     } else {
-      if (!fd) chan->buf.append(b.str());
-      else if (::send(fd, b.data(), b.size(), 0) != b.size()) PortForwardLocalCloseCB(fd, chan);
+      if (!fd) chan->buf.append(b.data(), b.size());
+      else {
+        auto f = forward_sockets.find(fd);
+        if (f == forward_sockets.end() || !PortForwardLocalWrite(fd, &f->second, b)) PortForwardLocalCloseCB(fd, chan);
+      }
     }
     return 0;
   }
@@ -478,6 +1214,16 @@ struct SSHTerminalController : public NetworkTerminalController {
   void PortForwardRemoteCloseCB(Socket fd, SSHClient::Channel *chan) {
     auto it = forward_fd.find(fd);
     if (it == forward_fd.end()) return;
+    auto f = forward_sockets.find(fd);
+    if (f != forward_sockets.end()) {
+      if (f->second.WriteQueued()) {
+        f->second.closing = true;
+        f->second.chan = nullptr;
+        UpdateForwardSocketWait(fd, &f->second);
+        return;
+      }
+      EraseForwardSocket(fd);
+    }
     app->scheduler.DelMainWaitSocket(parent->root, fd);
     SystemNetwork::CloseSocket(fd);
     forward_fd.erase(it);
@@ -485,6 +1231,140 @@ struct SSHTerminalController : public NetworkTerminalController {
 };
 #endif
 
+#if defined(LFL_CRYPTO) && defined(LFL_MOSH)
+struct MoshBootstrapTerminalController : public SSHTerminalController {
+  typedef function<void(const string&, const string&, const string&)> ConnectCB;
+  ConnectCB connect_cb;
+  string bootstrap_buf, bootstrap_out;
+  using SSHTerminalController::SSHTerminalController;
+
+  StringPiece Read() {
+    StringPiece b = SSHTerminalController::Read();
+    if (!connect_cb || b.empty()) return b;
+    bootstrap_buf.append(b.data(), b.size());
+    bootstrap_out.clear();
+    static const string connect_line = "MOSH CONNECT ";
+    for (size_t end; (end = bootstrap_buf.find_first_of("\r\n")) != string::npos; ) {
+      if (PrefixMatch(bootstrap_buf, connect_line)) return Connect(bootstrap_buf.substr(0, end));
+      bootstrap_out.append(bootstrap_buf, 0, end + 1);
+      bootstrap_buf.erase(0, end + 1);
+    }
+    // Hold back a partial line that may become the connect line, so the key never reaches the screen.
+    if (!PrefixMatch(connect_line, bootstrap_buf) && !PrefixMatch(bootstrap_buf, connect_line)) {
+      bootstrap_out.append(bootstrap_buf);
+      bootstrap_buf.clear();
+    }
+    return bootstrap_out;
+  }
+
+  StringPiece RecordData(const StringPiece &b) { return b; }
+
+  StringPiece Connect(const string &line) {
+    vector<string> words = Split(line, ' ');
+    if (words.size() < 4) return ERRORv(StringPiece(), "mosh: bad connect line");
+    if (!conn || !conn->addr) return ERRORv(StringPiece(), "mosh: no IPv4 address for ", remote);
+    ConnectCB cb;
+    swap(cb, connect_cb);
+    bootstrap_buf.clear();
+    cb(IPV4::Text(conn->addr), words[2], words[3]);
+    return bootstrap_out;
+  }
+};
+#endif
+
+#ifdef LFL_MOSH
+struct MoshTerminalController : public TerminalControllerInterface {
+  typedef ::Network::Transport<::Network::UserStream, ::Terminal::Complete> Transport;
+  string ip, port, key, read_buf;
+  int width, height;
+  unique_ptr<Transport> network;
+  ::Terminal::Framebuffer local_fb;
+  ::Terminal::Display display;
+  ::Overlay::OverlayManager overlays;
+  unique_ptr<TimerInterface> timer;
+  vector<int> wait_fds;
+  Callback close_cb;
+  bool repaint=true;
+
+  MoshTerminalController(TerminalTabInterface *p, string i, string po, string k, int w, int h, Callback ccb) :
+    TerminalControllerInterface(p), ip(move(i)), port(move(po)), key(move(k)), width(w), height(h),
+    local_fb(w, h), display(true), close_cb(move(ccb)) {}
+  virtual ~MoshTerminalController() { close_cb=Callback(); Close(); }
+
+  int GetConnectionState() const { return network ? Connection::Connected : Connection::Error; }
+
+  Socket Open(TextArea *t) {
+    ::Network::UserStream blank;
+    ::Terminal::Complete local_terminal(width, height);
+    try { network = make_unique<Transport>(blank, local_terminal, key.c_str(), ip.c_str(), port.c_str()); }
+    catch (const std::exception &e) { t->Write(StrCat("mosh: ", e.what(), "\r\n")); return InvalidSocket; }
+    network->set_send_delay(1);
+    timer = SystemToolkit::CreateTimer([=](){ if (parent->ControllerReadableCB()) parent->root->Wakeup(); });
+    UpdateWait();
+    return InvalidSocket;
+  }
+
+  StringPiece Read() {
+    if (!network) return StringPiece();
+    try { network->tick(); }
+    catch (const std::exception &e) { ERROR("mosh: ", e.what()); }
+    ::Terminal::Framebuffer new_state(network->get_latest_remote_state().state.get_fb());
+    overlays.apply(new_state);
+    read_buf = display.new_frame(!repaint, local_fb, new_state);
+    local_fb = new_state;
+    repaint = false;
+    if (network->counterparty_shutdown_ack_sent()) Close();
+    else UpdateWait();
+    return read_buf;
+  }
+
+  void Close() {
+    if (!network) return;
+    for (auto fd : wait_fds) app->scheduler.DelMainWaitSocket(parent->root, fd);
+    wait_fds.clear();
+    if (timer) timer->Clear();
+    network.reset();
+    if (close_cb) close_cb();
+  }
+
+  int Write(const StringPiece &b) {
+    if (!network) return -1;
+    overlays.get_prediction_engine().set_local_frame_sent(network->get_sent_state_last());
+    for (const char *c = b.data(); !b.Done(c); ++c) {
+      overlays.get_prediction_engine().new_user_byte(*c, local_fb);
+      network->get_current_state().push_back(::Parser::UserByte(*c));
+    }
+    timer->Run(Time(0), true);
+    return b.size();
+  }
+
+  void IOCtlWindowSize(int w, int h) {
+    if (!network) return;
+    network->get_current_state().push_back(::Parser::Resize((width = w), (height = h)));
+    overlays.get_prediction_engine().reset();
+    local_fb = ::Terminal::Framebuffer(w, h);
+    repaint = true;
+  }
+
+  bool RecvCB() {
+    if (!network) return false;
+    try { network->recv(); }
+    catch (const std::exception &e) { ERROR("mosh: ", e.what()); }
+    return parent->ControllerReadableCB();
+  }
+
+  void UpdateWait() {
+    vector<int> fds = network->fds();
+    if (fds != wait_fds) {
+      for (auto fd : wait_fds) app->scheduler.DelMainWaitSocket(parent->root, fd);
+      for (auto fd : (wait_fds = move(fds)))
+        app->scheduler.AddMainWaitSocket(parent->root, fd, SocketSet::READABLE, bind(&MoshTerminalController::RecvCB, this));
+    }
+    timer->Run(Time(max(1, min(network->wait_time(), overlays.wait_time()))), true);
+  }
+};
+#endif
+
 #ifdef LFL_RFB
 struct RFBTerminalController : public NetworkTerminalController, public KeyboardController, public MouseController {
   RFBClient::Params params;
@@ -602,6 +1482,7 @@ struct ShellTerminalController : public InteractiveTerminalController {
   StringCB telnet_cb;
 #ifdef LFL_CRYPTO
   function<void(SSHClient::Params)> ssh_cb;
+  function<string()> forwards_cb;
 #endif
 #ifdef LFL_RFB
   function<void(RFBClient::Params)> vnc_cb;
@@ -614,6 +1495,7 @@ struct ShellTerminalController : public InteractiveTerminalController {
     header = StrCat(LS("app_name"), " ", app->GetVersion(), ssh_usage, "\r\n\r\n");
 #ifdef LFL_CRYPTO
     shell.Add("ssh",      bind(&ShellTerminalController::MySSHCmd,      this, _1));
+    shell.Add("forwards", bind(&ShellTerminalController::MyForwardsCmd, this, _1));
 #endif
 #ifdef LFL_RFB
     shell.Add("vnc",      bind(&ShellTerminalController::MyVNCCmd,      this, _1));
@@ -651,6 +1533,11 @@ struct ShellTerminalController : public InteractiveTerminalController {
     if (login.empty() || host.empty()) { if (term) term->Write(ssh_usage); }
     else ssh_cb(SSHClient::Params{host, login, ssh_term, "", false, false, false});
   }
+
+  void MyForwardsCmd(const vector<string> &arg) {
+    string report = forwards_cb ? forwards_cb() : "";
+    WriteText(StrCat("\r\n\r\n", report.size() ? report : "No port forwards\r\n"));
+  }
 #endif
 
 #ifdef LFL_RFB
@@ -673,10 +1560,10 @@ struct ShellTerminalController : public InteractiveTerminalController {
   }
 
   void MyNetworkThreadNSLookup(const string &host) {
-    app->net->system_resolver->NSLookup(host, bind(&ShellTerminalController::MyNetworkThreadNSLookupResponse, this, host, _1, _2));
+    Singleton<TerminalDNSCache>::Get()->Lookup(host, bind(&ShellTerminalController::MyNetworkThreadNSLookupResponse, this, host, _1));
   }
 
-  void MyNetworkThreadNSLookupResponse(const string &host, IPV4::Addr ipv4_addr, DNS::Response*) {
+  void MyNetworkThreadNSLookupResponse(const string &host, IPV4::Addr ipv4_addr) {
     app->RunInMainThread(bind(&ShellTerminalController::UnBlockWithResponse, this, StrCat("host = ", IPV4::Text(ipv4_addr))));
   }
 
@@ -685,7 +1572,11 @@ struct ShellTerminalController : public InteractiveTerminalController {
               "* ssh -l user host[:port]\r\n"
               "* vnc -l user host[:port]\r\n"
               "* telnet host[:port]\r\n"
-              "* nslookup host\r\n");
+              "* nslookup host\r\n"
+#ifdef LFL_CRYPTO
+              "* forwards\r\n"
+#endif
+              );
   }
 
   static void ParseHostAndLogin(const vector<string> &arg, string *host, string *login) {
@@ -697,10 +1588,248 @@ struct ShellTerminalController : public InteractiveTerminalController {
 
 struct BufferedShellTerminalController : public ShellTerminalController {
   using ShellTerminalController::ShellTerminalController;
-  int Write(const StringPiece &text) {
-    for (const char *b = text.data(); !text.Done(b); ++b)
-      ShellTerminalController::Write(StringPiece(b, 1));
-    return text.size();
+};
+
+struct TerminalReadCoalescer {
+  Time refresh_interval, window=Time(250), window_start=Time::zero();
+  int bulk_read_size, window_limit, window_bytes=0;
+  bool flooding=false;
+  TerminalReadCoalescer(Time ri, int brs, int rate) :
+    refresh_interval(ri), bulk_read_size(brs), window_limit(rate * window.count() / 1000) {}
+
+  bool DeferDraw(int read_size, Time now) {
+    if (now - window_start > window) {
+      flooding = window_bytes > window_limit && now - window_start <= window * 2;
+      window_start = now;
+      window_bytes = 0;
+    }
+    window_bytes += read_size;
+    return flooding || read_size > bulk_read_size || window_bytes > window_limit;
+  }
+};
+
+struct TerminalPasteStreamer {
+  string data;
+  size_t offset=0, high_water;
+  TerminalPasteStreamer(const StringPiece &text, bool bracketed=false, size_t hw=65536) : high_water(hw) {
+    static const char start[] = "\x1b[200~", end[] = "\x1b[201~";
+    data.reserve(text.size() + (bracketed ? 12 : 0));
+    if (bracketed) data.append(start);
+    for (const char *b = text.data(); !text.Done(b); ++b) {
+      if (*b == '\r' && !text.Done(b+1) && b[1] == '\n') continue;
+      if (bracketed && *b == '\x1b' && text.end() - b >= 6 && !memcmp(b, end, 6)) { b += 5; continue; }
+      data.append(1, *b == '\n' ? '\r' : *b);
+    }
+    if (bracketed) data.append(end);
+  }
+
+  bool Done() const { return offset >= data.size(); }
+
+  int Step(TerminalControllerInterface *c) {
+    size_t queued = c->GetWriteQueueSize();
+    if (Done() || queued >= high_water) return 0;
+    int ret = c->Write(StringPiece(data.data() + offset, min(high_water - queued, data.size() - offset)));
+    if (ret > 0) offset += ret;
+    return ret;
+  }
+};
+
+struct TerminalPasteMode {
+  bool bracketed=0;
+  string tail;
+
+  void Scan(const StringPiece &b) {
+    if (tail.size()) ScanBuffer(tail + string(b.data(), min<size_t>(b.size(), 8)));
+    ScanBuffer(b);
+    tail.append(b.data(), b.size());
+    if (tail.size() > 7) tail.erase(0, tail.size() - 7);
+  }
+
+  void ScanBuffer(const StringPiece &b) {
+    const char *end = b.data() + b.size();
+    for (const char *p = b.data(); (p = static_cast<const char*>(memchr(p, '\x1b', end - p))); p++)
+      if (end - p >= 8 && !memcmp(p, "\x1b[?2004", 7) && (p[7] == 'h' || p[7] == 'l')) bracketed = p[7] == 'h';
+  }
+};
+
+// Seeking is approximate: only visible text and the cursor are kept, cell attributes and modes
+// are not. The prefix resets alt screen, scroll region, origin/insert mode and SGR first.
+template <class TerminalType> string TerminalSnapshot(TerminalType *t) {
+  string ret = "\x1b[?1049l\x1b[r\x1b[?6l\x1b[4l\x1b[0m\x1b[H\x1b[2J";
+  for (int i = 1; i <= t->term_height; i++)
+    StrAppend(&ret, "\x1b[", i, ";1H", String::ToUTF8(t->GetTermLine(i)->Text16()));
+  StrAppend(&ret, "\x1b[", t->term_cursor.y, ";", t->term_cursor.x, "H");
+  return ret;
+}
+
+struct TerminalRecorder {
+  enum class Policy { Drop, Block };
+  struct Chunk { Time stamp=Time::zero(); string data, snapshot; bool keyframe=0; };
+  string filename;
+  Time keyframe_interval, keyframe_stamp=Time::zero(), merge_window=Time(10), flush_interval=Time(100);
+  Policy policy;
+  size_t max_bytes, max_retained_capacity=65536, block_size=65536;
+  bool compress, need_keyframe=true;
+  int compress_level=6;
+  vector<Chunk> ring;
+  atomic<size_t> head{0}, tail{0}, queued_bytes{0};
+  atomic<long long> dropped_chunks{0}, dropped_bytes{0};
+  atomic<bool> done{false}, failed{false};
+  mutex wakeup_mutex, space_mutex;
+  condition_variable wakeup, space;
+  thread writer;
+
+  TerminalRecorder(const string &fn, Time ki, Policy p=Policy::Drop, bool z=true, int max_chunks=4096, size_t mb=16*1024*1024) :
+    filename(fn), keyframe_interval(ki), policy(p), max_bytes(mb), compress(z), ring(max(1, max_chunks)),
+    writer(&TerminalRecorder::WriterThread, this) {}
+
+  ~TerminalRecorder() {
+    { lock_guard<mutex> lock(wakeup_mutex); done = true; }
+    wakeup.notify_one();
+    writer.join();
+    if (dropped_chunks) ERROR("recorder ", filename, " dropped ", dropped_chunks.load(), " chunks, ", dropped_bytes.load(), " bytes");
+  }
+
+  bool KeyframeDue(Time stamp) const {
+    return keyframe_interval.count() && (need_keyframe || stamp - keyframe_stamp >= keyframe_interval);
+  }
+
+  bool Full(size_t t, size_t len) const {
+    size_t queued = queued_bytes.load(memory_order_relaxed);
+    return t - head.load(memory_order_acquire) >= ring.size() || (queued && queued + len > max_bytes);
+  }
+
+  bool Add(Time stamp, const StringPiece &b, bool keyframe, string snapshot) {
+    if (failed) return false;
+    size_t t = tail.load(memory_order_relaxed);
+    if (Full(t, b.len)) {
+      if (policy == Policy::Drop) {
+        dropped_chunks++;
+        dropped_bytes += b.len;
+        need_keyframe = true;
+        return false;
+      }
+      wakeup.notify_one();
+      unique_lock<mutex> lock(space_mutex);
+      space.wait(lock, [&](){ return done.load() || failed.load() || !Full(t, b.len); });
+      if (done || failed) return false;
+    }
+    Chunk &c = ring[t % ring.size()];
+    c.stamp = stamp;
+    c.data.assign(b.buf, b.len);
+    c.snapshot = move(snapshot);
+    if ((c.keyframe = keyframe)) { keyframe_stamp = stamp; need_keyframe = false; }
+    size_t queued = (queued_bytes += b.len);
+    tail.store(t + 1, memory_order_release);
+    if (t + 1 - head.load(memory_order_relaxed) >= ring.size() / 2 || queued >= max_bytes / 2) wakeup.notify_one();
+    return true;
+  }
+
+  void WriterThread() {
+#ifdef LFL_FLATBUFFERS
+    FlatFile record(filename);
+    unique_ptr<FlatFile> index(keyframe_interval.count() ? make_unique<FlatFile>(StrCat(filename, ".index")) : nullptr);
+    unsigned long long records = 0;
+    long long reported_drops = 0;
+    string pending, block, compressed;
+    vector<unsigned> block_stamps, block_sizes;
+    Time pending_stamp = Time::zero(), block_stamp = Time::zero();
+    bool block_reset = true;
+    z_stream zs;
+    memzero(zs);
+    if (compress && deflateInit(&zs, compress_level) != Z_OK) {
+      ERROR("recorder ", filename, " deflateInit failed, recording stopped");
+      failed = true;
+    }
+
+    auto flush_block = [&]() {
+      if (failed || block_sizes.empty()) return;
+      compressed.resize(deflateBound(&zs, block.size()) + 64);
+      zs.next_in = MakeUnsigned(&block[0]);
+      zs.avail_in = block.size();
+      zs.next_out = MakeUnsigned(&compressed[0]);
+      zs.avail_out = compressed.size();
+      if (deflate(&zs, Z_SYNC_FLUSH) != Z_OK) {
+        ERROR("recorder ", filename, " deflate failed, recording stopped");
+        failed = true;
+        block.clear();
+        block_stamps.clear();
+        block_sizes.clear();
+        return;
+      }
+      compressed.resize(compressed.size() - zs.avail_out);
+      record.Add(MakeFlatBufferOfType
+                 (LTerminal::RecordLog, LTerminal::CreateRecordLog
+                  (fb, block_stamp.count(), 0, fb.CreateVector(MakeUnsigned(compressed.data()), compressed.size()),
+                   fb.CreateVector(block_stamps), fb.CreateVector(block_sizes), block_reset)));
+      block_reset = false;
+      block.clear();
+      block_stamps.clear();
+      block_sizes.clear();
+    };
+
+    auto flush_pending = [&]() {
+      if (pending.empty()) return;
+      if (!compress) record.Add(MakeFlatBufferOfType
+                                (LTerminal::RecordLog, LTerminal::CreateRecordLog(fb, pending_stamp.count(), fb.CreateVector(MakeUnsigned(pending.data()), pending.size()))));
+      else {
+        if (block_sizes.empty()) block_stamp = pending_stamp;
+        block_stamps.push_back((pending_stamp - block_stamp).count());
+        block_sizes.push_back(pending.size());
+        block.append(pending);
+        if (block.size() >= block_size) flush_block();
+      }
+      pending.clear();
+      records++;
+    };
+
+    for (bool exiting = false; !exiting && !failed; ) {
+      {
+        unique_lock<mutex> lock(wakeup_mutex);
+        wakeup.wait_for(lock, flush_interval, [&](){
+          return done.load() || tail.load() - head.load() >= ring.size() / 2 || queued_bytes.load() >= max_bytes / 2;
+        });
+        exiting = done;
+      }
+      for (size_t h = head.load(memory_order_relaxed), t = tail.load(memory_order_acquire); h != t; h++) {
+        Chunk &c = ring[h % ring.size()];
+        if (c.keyframe || pending.empty() || c.stamp - pending_stamp > merge_window) {
+          flush_pending();
+          pending_stamp = c.stamp;
+        }
+        if (c.keyframe && compress) {
+          flush_block();
+          deflateReset(&zs);
+          block_reset = true;
+        }
+        if (c.keyframe && index)
+          index->Add(MakeFlatBufferOfType
+                     (LTerminal::RecordKeyframe, LTerminal::CreateRecordKeyframe
+                      (fb, c.stamp.count(), record.file->Seek(0, File::Whence::CUR), records,
+                       fb.CreateVector(MakeUnsigned(c.snapshot.data()), c.snapshot.size()))));
+        pending.append(c.data);
+        queued_bytes -= c.data.size();
+        if (c.data.capacity() > max_retained_capacity) string().swap(c.data);
+        else c.data.clear();
+        c.snapshot.clear();
+        head.store(h + 1, memory_order_release);
+      }
+      if (policy == Policy::Block) {
+        { lock_guard<mutex> lock(space_mutex); }
+        space.notify_one();
+      }
+      flush_pending();
+      flush_block();
+      long long drops = dropped_chunks.load();
+      if (drops != reported_drops) {
+        ERROR("recorder ", filename, " falling behind, dropped ", drops - reported_drops, " chunks");
+        reported_drops = drops;
+      }
+    }
+    if (compress) deflateEnd(&zs);
+#endif
+    { lock_guard<mutex> lock(space_mutex); }
+    space.notify_all();
   }
 };
 
@@ -708,7 +1837,8 @@ template <class TerminalType> struct TerminalTabT : public TerminalTabInterface
   TerminalType *terminal;
   View scrollbar_view;
   Widget::Slider scrollbar;
-  unique_ptr<FlatFile> record;
+  unique_ptr<TerminalRecorder> record;
+  TerminalPasteMode paste_mode;
 
   TerminalTabT(Window *W, const char *n, TerminalType *t, int host_id, bool hide_sb) :
     TerminalTabInterface(W, n, 1.0, 1.0, 0, host_id, hide_sb), terminal(t), scrollbar_view(W, "ScrollbarView"), scrollbar(&scrollbar_view) {
@@ -738,6 +1868,7 @@ template <class TerminalType> struct TerminalTabT : public TerminalTabInterface
     controller.swap(last_controller);
     controller = move(new_controller);
     terminal->sink = controller.get();
+    paste_mode = TerminalPasteMode();
     Socket fd = controller ? controller->Open(terminal) : InvalidSocket;
     app->scheduler.AddMainWaitSocket
       (root, fd, SocketSet::READABLE, bind(&TerminalTabInterface::ControllerReadableCB, this));
@@ -749,17 +1880,29 @@ template <class TerminalType> struct TerminalTabT : public TerminalTabInterface
     }
   }
 
+  void StartRecording(const string &fn, Time keyframe_interval, bool backpressure=false, bool compress=true) {
+    record = make_unique<TerminalRecorder>(fn, keyframe_interval, backpressure ? TerminalRecorder::Policy::Block : TerminalRecorder::Policy::Drop, compress);
+  }
+
   int ReadAndUpdateTerminalFramebuffer() {
     if (!controller) return 0;
-    StringPiece s = controller->Read();
+    TerminalControllerInterface *c = controller.get();
+    StringPiece s = c->Read();
     if (s.len) {
+      StringPiece r = record ? c->RecordData(s) : StringPiece();
+      if (r.len) {
+        Time stamp = Now() - app->time_started;
+        bool keyframe = record->KeyframeDue(stamp);
+        record->Add(stamp, r, keyframe, keyframe ? TerminalSnapshot(terminal) : string());
+        if (record->failed) {
+          record.reset();
+          terminal->Write(StrCat("\r\n", LS("recording_failed"), "\r\n"));
+        }
+      }
+      paste_mode.Scan(s);
       terminal->Write(s);
-#ifdef LFL_FLATBUFFERS
-      if (record) record->Add
-        (MakeFlatBufferOfType
-         (LTerminal::RecordLog, LTerminal::CreateRecordLog(fb, (Now() - app->time_started).count(), fb.CreateVector(MakeUnsigned(s.buf), s.len))));
-#endif
     }
+    c->ReadConsumed();
     return s.len;
   }
 
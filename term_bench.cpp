@@ -0,0 +1,202 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "zlib.h"
+#include "core/app/app.h"
+#include "core/app/shell.h"
+#include "core/app/gl/view.h"
+#include "core/app/gl/terminal.h"
+#include "core/app/net/resolver.h"
+#ifdef LFL_FLATBUFFERS
+#include "LTerminal/term_generated.h"
+#endif
+
+namespace LFL {
+DEFINE_string(bench_workload,  "ascii,sgr,cursor,cjk", "Synthetic workloads to replay");
+DEFINE_string(bench_file,      "",     "Replay recorded session file");
+DEFINE_int   (bench_mb,        32,     "Megabytes replayed per synthetic workload");
+DEFINE_int   (bench_read_size, 4096,   "Bytes per simulated read");
+DEFINE_int   (bench_repeat,    1,      "Times to replay the recorded session file");
+
+Application *app;
+inline string   LS  (const char *n) { return app->GetLocalizedString(n); }
+inline String16 LS16(const char *n) { return app->GetLocalizedString16(n); }
+
+}; // namespace LFL
+#include "term.h"
+namespace LFL {
+
+struct BenchTerminalController : public TerminalControllerInterface {
+  const vector<string> *chunks;
+  size_t chunk_ind=0;
+  BenchTerminalController(TerminalTabInterface *p, const vector<string> *c) : TerminalControllerInterface(p), chunks(c) {}
+  Socket Open(TextArea*) { return InvalidSocket; }
+  int Write(const StringPiece &b) { return b.size(); }
+  bool Done() const { return chunk_ind >= chunks->size(); }
+  StringPiece Read() { return Done() ? StringPiece() : StringPiece((*chunks)[chunk_ind++]); }
+};
+
+struct BenchTerminalTab : public TerminalTab {
+  BenchTerminalTab(Window *W) :
+    TerminalTab(W, "BenchTerminalTab", W->AddView(make_unique<Terminal>(nullptr, W, W->default_font, point(80,25))), 0, true) {}
+  virtual ~BenchTerminalTab() { root->DelView(terminal); }
+  bool GetFocused() const override { return true; }
+  void SetFontSize(int) override {}
+  void UpdateTargetFPS() override {}
+  void DrawBox(GraphicsDevice*, Box, bool) override {}
+};
+
+struct BenchResult {
+  string name;
+  long long bytes=0, lines=0, reads=0;
+  double seconds=0, p50_us=0, p99_us=0;
+};
+
+static string MakeASCIIPattern() {
+  string ret;
+  for (int line = 0; ret.size() < 65536; line++) {
+    for (int i = 0; i < 79; i++) ret.append(1, ' ' + (line + i) % 95);
+    ret.append("\r\n");
+  }
+  return ret;
+}
+
+static string MakeSGRPattern() {
+  string ret;
+  for (int line = 0; ret.size() < 65536; line++) {
+    for (int word = 0; word < 10; word++)
+      StrAppend(&ret, "\x1b[", (word & 1) ? "1;" : "", 30 + (line + word) % 8, ";", 40 + word % 8, "m",
+                "word", word, "\x1b[38;5;", (line * 10 + word) % 256, "m ", "\x1b[0m");
+    ret.append("\r\n");
+  }
+  return ret;
+}
+
+static string MakeCursorPattern() {
+  string ret = "\x1b[?1049h\x1b[1;24r";
+  for (int frame = 0; ret.size() < 65536; frame++) {
+    ret.append("\x1b[H");
+    for (int row = 1; row <= 24; row++)
+      StrAppend(&ret, "\x1b[", row, ";1H\x1b[", (row + frame) % 2 ? "7" : "0", "m",
+                StringPrintf("%5d %-8s %5.1f %5.1f ", frame * 24 + row, "proc", (row * 7 + frame) % 100 / 1.0,
+                             (row * 3 + frame) % 100 / 1.0), "\x1b[0m\x1b[K");
+    ret.append("\x1b[24;1H\r\n\x1b[23;1H\x1b[M\x1b[1;1H\x1b[L");
+  }
+  return ret;
+}
+
+static string MakeCJKPattern() {
+  string ret;
+  for (int line = 0; ret.size() < 65536; line++) {
+    for (int i = 0; i < 39; i++) ret.append(String::ToUTF8(String16(1, 0x4e00 + (line * 39 + i) % 0x5000)));
+    ret.append("\r\n");
+  }
+  return ret;
+}
+
+static vector<string> MakeSyntheticChunks(const string &pattern, size_t total, size_t read_size) {
+  vector<string> ret;
+  string stream;
+  while (stream.size() < total) stream.append(pattern);
+  for (size_t i = 0; i < stream.size(); i += read_size) ret.emplace_back(stream.substr(i, read_size));
+  return ret;
+}
+
+static vector<string> LoadRecordedChunks(const string &fn) {
+  vector<string> ret;
+  TerminalRecordReader playback(fn);
+  unsigned long long stamp;
+  for (string data; playback.Next(&stamp, &data); ) if (data.size()) ret.push_back(data);
+  return ret;
+}
+
+static BenchResult RunBenchmark(Window *W, const string &name, const vector<string> &chunks) {
+  BenchResult ret;
+  ret.name = name;
+  for (auto &c : chunks) {
+    ret.bytes += c.size();
+    ret.lines += count(c.begin(), c.end(), '\n');
+  }
+
+  BenchTerminalTab tab(W);
+  tab.ChangeController(make_unique<BenchTerminalController>(&tab, &chunks));
+  auto controller = dynamic_cast<BenchTerminalController*>(tab.controller.get());
+  vector<double> latency_us;
+  latency_us.reserve(chunks.size());
+
+  auto start = chrono::steady_clock::now();
+  while (!controller->Done()) {
+    auto read_start = chrono::steady_clock::now();
+    tab.ReadAndUpdateTerminalFramebuffer();
+    latency_us.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - read_start).count());
+  }
+  ret.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  ret.reads = latency_us.size();
+
+  if (latency_us.size()) {
+    size_t p50 = latency_us.size() / 2, p99 = latency_us.size() * 99 / 100;
+    nth_element(latency_us.begin(), latency_us.begin() + p50, latency_us.end());
+    ret.p50_us = latency_us[p50];
+    nth_element(latency_us.begin(), latency_us.begin() + p99, latency_us.end());
+    ret.p99_us = latency_us[p99];
+  }
+  return ret;
+}
+
+static void PrintResult(const BenchResult &r) {
+  double seconds = max(r.seconds, 1e-9);
+  printf("%-16s %10.2f MB/s %12.0f lines/s %10lld reads  p50 %9.2f us  p99 %9.2f us\n", r.name.c_str(),
+         r.bytes / seconds / (1024*1024), r.lines / seconds, r.reads, r.p50_us, r.p99_us);
+  fflush(stdout);
+}
+
+}; // namespace LFL
+using namespace LFL;
+
+extern "C" LFApp *MyAppCreate(int argc, const char* const* argv) {
+  app = make_unique<Application>(argc, argv).release();
+  app->focused = app->framework->ConstructWindow(app).release();
+  app->name = "LTerminalBench";
+  return app;
+}
+
+extern "C" int MyAppMain(LFApp*) {
+  FLAGS_font = FakeFontEngine::Filename();
+  if (app->Create(__FILE__)) return -1;
+  size_t total = size_t(max(0, FLAGS_bench_mb)) * 1024 * 1024;
+  size_t read_size = max(1, FLAGS_bench_read_size);
+  unordered_map<string, function<string()>> workloads = {
+    { "ascii",  &MakeASCIIPattern },
+    { "sgr",    &MakeSGRPattern },
+    { "cursor", &MakeCursorPattern },
+    { "cjk",    &MakeCJKPattern },
+  };
+
+  for (auto &w : Split(FLAGS_bench_workload, ',')) {
+    auto it = workloads.find(w);
+    if (it == workloads.end()) { ERROR("unknown workload ", w); continue; }
+    PrintResult(RunBenchmark(app->focused, w, MakeSyntheticChunks(it->second(), total, read_size)));
+  }
+
+  if (FLAGS_bench_file.size()) {
+    vector<string> recorded = LoadRecordedChunks(FLAGS_bench_file), chunks;
+    for (int i = 0; i < FLAGS_bench_repeat; i++) chunks.insert(chunks.end(), recorded.begin(), recorded.end());
+    PrintResult(RunBenchmark(app->focused, FLAGS_bench_file, chunks));
+  }
+  return 0;
+}
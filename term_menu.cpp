@@ -105,7 +105,7 @@ MyGenKeyViewController::MyGenKeyViewController(MyTerminalMenus *m) : MyTableView
     TableItem(LS("size"),       TableItem::Separator, ""),
     TableItem(LS("bits"),       TableItem::Selector, "2048,4096", "", 0, 0, 0, Callback(), StringCB(), TableItem::Flag::HideKey),
     TableItem("",               TableItem::Separator, ""),
-    TableItem(LS("generate"),   TableItem::Command, "", ">", 0, m->keygen_icon, 0, bind(&MyTerminalMenus::GenerateKey, m))
+    TableItem(LS("generate"),   TableItem::Command, "", ">", 0, m->keygen_icon, 0, bind(&MyTerminalMenus::GenerateKeyInBackground, m))
     });
   view->show_cb = bind(&MyGenKeyViewController::UpdateViewFromModel, this);
   algo_deps = {
@@ -240,6 +240,8 @@ MyAppSettingsViewController::MyAppSettingsViewController(MyTerminalMenus *m) :
     TableItem(LS("local_encryption_type"), TableItem::Command, "", StrCat(LS("enabled")," >"), 0, m->locked_icon, 0, bind(&MyTerminalMenus::DisableLocalEncryption, m)),
     TableItem(LS("theme"),           TableItem::Selector, StrCat(LS("light"),",",LS("dark")), "", 0, m->eye_icon, 0, Callback(), [=](const string &n){ view->SetSelected(0, 2, n != LS("light")); m->ChangeTheme(n == LS("light") ? "Light" : "Dark"); }),
     TableItem(LS("keep_display_on"), TableItem::Toggle,  ""),
+    TableItem(LS("prewarm_hosts"),   TableItem::Toggle,  ""),
+    TableItem(LS("key_cache_minutes"), TableItem::Selector, StrCat(LS("forever"), ",5,15,60"), "", 0, m->key_icon, 0, Callback(), StringCB()),
 #ifdef LFL_IOS
     TableItem(LS("background_timeout"), TableItem::Slider, "", "", 0, 0, 0, Callback(), StringCB(), 0, 0, 0, "", Color::clear, Color::clear, 0, 180),
 #endif
@@ -253,7 +255,7 @@ MyAppSettingsViewController::MyAppSettingsViewController(MyTerminalMenus *m) :
     view->SetHidden(0, 1, !m->db_opened || !m->db_protected);
     view->SetSelected(0, 2, m->theme == "Dark");
 #ifdef LFL_IOS
-    view->SetValue(0, 4, StrCat(app->background_timeout));
+    view->SetValue(0, 6, StrCat(app->background_timeout));
 #endif
     view->EndUpdates();
     view->changed = false;
@@ -271,17 +273,22 @@ MyAppSettingsViewController::MyAppSettingsViewController(MyTerminalMenus *m) :
 void MyAppSettingsViewController::UpdateViewFromModel(const MyAppSettingsModel &model) {
   view->BeginUpdates();
   view->SetValue(0, 3, model.keep_display_on ? "1" : "");
+  view->SetValue(0, 4, model.prewarm_hosts ? "1" : "");
+  view->SetValue(0, 5, model.identity_cache_ttl ? StrCat(model.identity_cache_ttl) : LS("forever"));
   view->EndUpdates();
 }
 
 void MyAppSettingsViewController::UpdateModelFromView(MyAppSettingsModel *model) {
-  string a="", b="", theme=LS("theme"), keepdisplayon=LS("keep_display_on"), background_timeout=LS("background_timeout");
-  if (!view->GetSectionText(0, {&a, &b, &theme, &keepdisplayon
+  string a="", b="", theme=LS("theme"), keepdisplayon=LS("keep_display_on"), prewarm=LS("prewarm_hosts"),
+         keycache=LS("key_cache_minutes"), background_timeout=LS("background_timeout");
+  if (!view->GetSectionText(0, {&a, &b, &theme, &keepdisplayon, &prewarm, &keycache
 #ifdef LFL_IOS
                             , &background_timeout
 #endif
                             })) return ERROR("parse appsettings0");
   model->keep_display_on = keepdisplayon == "1";
+  model->prewarm_hosts = prewarm == "1";
+  model->identity_cache_ttl = keycache == LS("forever") ? 0 : atoi(keycache);
 #ifdef LFL_IOS
   model->background_timeout = Clamp(atoi(background_timeout), 0, 180);
 #endif
@@ -377,7 +384,7 @@ void MySSHFingerprintViewController::UpdateViewFromModel(const MyHostModel &mode
 
 MySSHPortForwardViewController::MySSHPortForwardViewController(MyTerminalMenus *m) :
   MyTableViewController(m, m->toolkit->CreateTableView(m->win->focused, LS("new_port_forward"), "", m->theme, TableItemVec{
-    TableItem(LS("type"), TableItem::Selector, StrCat(LS("local"), ",", LS("remote")), "", 0, 0, 0, Callback(), bind(&MySSHPortForwardViewController::ApplyTypeChangeSet, this, _1), TableItem::Flag::HideKey),
+    TableItem(LS("type"), TableItem::Selector, StrCat(LS("local"), ",", LS("remote"), ",", LS("dynamic")), "", 0, 0, 0, Callback(), bind(&MySSHPortForwardViewController::ApplyTypeChangeSet, this, _1), TableItem::Flag::HideKey),
     TableItem("",                TableItem::Separator, ""),
     TableItem(LS("local_port"),  TableItem::NumberInput, TableItem::Placeholder(LS("port"))),
     TableItem(LS("target_host"), TableItem::TextInput,   TableItem::Placeholder(LS("hostname"))),
@@ -388,7 +395,11 @@ MySSHPortForwardViewController::MySSHPortForwardViewController(MyTerminalMenus *
       view->GetSectionText(0, {&type});
       view->GetSectionText(1, {&port_text, &target_host, &target_port_text});
       int port = atoi(port_text), target_port = atoi(target_port_text);
-      if (port && target_port && ContainsChar(target_host.data(), isalnum, target_host.size())) {
+      if (port && type == LS("dynamic")) {
+        m->sshsettings.view->BeginUpdates();
+        m->sshsettings.view->AddRow(2, TableItem{ StrCat(type, " ", port), TableItem::Label, "SOCKS5", "", 0, m->arrowright_icon });
+        m->sshsettings.view->EndUpdates();
+      } else if (port && target_port && ContainsChar(target_host.data(), isalnum, target_host.size())) {
         bool local = type == LS("local");
         string k = StrCat(type, " ", port), v = StrCat(target_host, ":", target_port);
         m->sshsettings.view->BeginUpdates();
@@ -407,6 +418,7 @@ MySSHPortForwardViewController::MySSHPortForwardViewController(MyTerminalMenus *
   type_deps = {
     {LS("local"),  {{1,0,TableItem::Placeholder(LS("port")),0,0,0,0,LS("local_port")},  {1,2,TableItem::Placeholder(LS("port")),0,0,0,0,LS("target_port")} }},
     {LS("remote"), {{1,0,TableItem::Placeholder(LS("port")),0,0,0,0,LS("remote_port")}, {1,2,TableItem::Placeholder(LS("port")),0,0,0,0,LS("target_port")} }},
+    {LS("dynamic"), {{1,0,TableItem::Placeholder(LS("port")),0,0,0,0,LS("local_port")}, {1,2,TableItem::Placeholder(LS("none")),0,0,0,0,LS("target_port")} }},
   };
 }
 
@@ -427,6 +439,7 @@ vector<TableItem> MySSHSettingsViewController::GetSchema(MyTerminalMenus *m) {
     TableItem(LS("agent_forwarding"),     TableItem::Toggle,    ""),
     TableItem(LS("compression"),          TableItem::Toggle,    ""),
     TableItem(LS("close_on_disconnect"),  TableItem::Toggle,    ""),
+    TableItem(LS("local_echo"),           TableItem::Toggle,    ""),
     TableItem(LS("startup_command"),      TableItem::TextInput, "") };
 }
 
@@ -436,6 +449,7 @@ void MySSHSettingsViewController::UpdateViewFromModel(const MyHostModel &model)
   };
   for (auto &f : model.settings.local_forward)  forwards.emplace_back(StrCat(LS("local"),  " ", f.port), TableItem::Label, StrCat(f.target_host, ":", f.target_port), "", 0, menus->arrowright_icon);
   for (auto &f : model.settings.remote_forward) forwards.emplace_back(StrCat(LS("remote"), " ", f.port), TableItem::Label, StrCat(f.target_host, ":", f.target_port), "", 0, menus->arrowleft_icon);
+  for (auto &p : model.settings.dynamic_forward) forwards.emplace_back(StrCat(LS("dynamic"), " ", p), TableItem::Label, "SOCKS5", "", 0, menus->arrowright_icon);
   view->BeginUpdates();
   view->SetSectionValues(0, vector<string>{
     model.folder.size() ? model.folder : TableItem::Placeholder(LS("none")), model.settings.terminal_type,
@@ -444,6 +458,7 @@ void MySSHSettingsViewController::UpdateViewFromModel(const MyHostModel &model)
     model.settings.agent_forwarding ? "1" : "",
     model.settings.compression ? "1" : "",
     model.settings.close_on_disconnect ? "1" : "",
+    model.settings.local_echo ? "1" : "",
     model.settings.startup_command.size() ? model.settings.startup_command : TableItem::Placeholder(LS("none")) });
   view->ReplaceSection(2, TableItem(LS("port_forwarding")), TableSectionInterface::Flag::EditButton, forwards);
   view->EndUpdates();
@@ -454,18 +469,22 @@ bool MySSHSettingsViewController::UpdateModelFromView(MyHostSettingsModel *model
   model->terminal_type = LS("terminal_type");
   model->startup_command = LS("startup_command");
   string textencoding=LS("text_encoding"), fingerprint=LS("host_key_fingerprint"),
-         forwarding=LS("agent_forwarding"), compression=LS("compression"), disconclose=LS("close_on_disconnect");
+         forwarding=LS("agent_forwarding"), compression=LS("compression"), disconclose=LS("close_on_disconnect"),
+         localecho=LS("local_echo");
   if (!view->GetSectionText(0, {folder, &model->terminal_type, &textencoding, &fingerprint})) return ERRORv(false, "parse newhostconnect settings0");
-  if (!view->GetSectionText(1, {&forwarding, &compression, &disconclose, &model->startup_command})) return ERRORv(false, "parse newhostconnect settings1");
+  if (!view->GetSectionText(1, {&forwarding, &compression, &disconclose, &localecho, &model->startup_command})) return ERRORv(false, "parse newhostconnect settings1");
   model->agent_forwarding    = forwarding  == "1";
   model->compression         = compression == "1";
   model->close_on_disconnect = disconclose == "1";
+  model->local_echo          = localecho   == "1";
   model->local_forward.clear();
   model->remote_forward.clear();
+  model->dynamic_forward.clear();
 
-  string local=StrCat(LS("local")," "), remote=StrCat(LS("remote")," ");
+  string local=StrCat(LS("local")," "), remote=StrCat(LS("remote")," "), dynamic=StrCat(LS("dynamic")," ");
   StringPairVec forwards = view->GetSectionText(2);
   for (auto i = forwards.begin()+1, e = forwards.end(); i != e; ++i) {
+    if (PrefixMatch(i->first, dynamic)) { model->dynamic_forward.push_back(atoi(i->first.data() + dynamic.size())); continue; }
     string target, target_port;
     if (2 != Split(i->second, isint<':'>, &target, &target_port)) continue;
     if      (PrefixMatch(i->first, local))  model->local_forward .push_back({ atoi(i->first.data() + local.size()),  target, atoi(target_port) });
@@ -557,6 +576,7 @@ bool MyLocalShellSettingsViewController::UpdateModelFromView(MyHostSettingsModel
 MyProtocolViewController::MyProtocolViewController(MyTerminalMenus *m) :
   MyTableViewController(m, m->toolkit->CreateTableView(m->win->focused, LS("protocol"), "", m->theme, TableItemVec{
   TableItem(LS("ssh"),         TableItem::Command, "", ">", 0, m->host_locked_icon, 0, bind(&MyTerminalMenus::ChooseProtocol, m, "SSH")),
+  TableItem(LS("mosh"),        TableItem::Command, "", ">", 0, m->host_locked_icon, 0, bind(&MyTerminalMenus::ChooseProtocol, m, "Mosh")),
   TableItem(LS("telnet"),      TableItem::Command, "", ">", 0, m->host_icon,        0, bind(&MyTerminalMenus::ChooseProtocol, m, "Telnet")), 
   TableItem(LS("vnc"),         TableItem::Command, "", ">", 0, m->vnc_icon,         0, bind(&MyTerminalMenus::ChooseProtocol, m, "VNC")),
   TableItem(LS("local_shell"), TableItem::Command, "", ">", 0, m->terminal_icon,    0, bind(&MyTerminalMenus::ChooseProtocol, m, "Local Shell")) })) {
@@ -576,6 +596,7 @@ vector<TableItem> MyQuickConnectViewController::GetSchema(MyTerminalMenus *m) {
 TableSectionInterface::ChangeSet MyQuickConnectViewController::GetProtoDepends(MyTerminalMenus *m) {
   return {
     {"SSH",         {{0,0,TableItem::Placeholder(StrCat(LS("host"),"[:",LS("port"),"]")),false,m->host_locked_icon,0,TableItem::TextInput,LS("ssh")},         {0,1,TableItem::Placeholder(LS("username"))}, {0,2,m->pw_default,false,0,0,0,"",Callback(),0},                            {2,0,"",false,m->settings_gray_icon,0,0,LS("ssh_settings"),        bind(&MyTerminalMenus::ShowProtocolSettings, m, LTerminal::Protocol_SSH) } }},
+    {"Mosh",        {{0,0,TableItem::Placeholder(StrCat(LS("host"),"[:",LS("port"),"]")),false,m->host_locked_icon,0,TableItem::TextInput,LS("mosh")},        {0,1,TableItem::Placeholder(LS("username"))}, {0,2,m->pw_default,false,0,0,0,"",Callback(),0},                            {2,0,"",false,m->settings_gray_icon,0,0,LS("ssh_settings"),        bind(&MyTerminalMenus::ShowProtocolSettings, m, LTerminal::Protocol_Mosh) } }},
     {"Telnet",      {{0,0,TableItem::Placeholder(StrCat(LS("host"),"[:",LS("port"),"]")),false,m->host_icon,       0,TableItem::TextInput,LS("telnet")},      {0,1,"",true},                                {0,2,"",true,0,0},                                                          {2,0,"",false,m->settings_gray_icon,0,0,LS("telnet_settings"),     bind(&MyTerminalMenus::ShowProtocolSettings, m, LTerminal::Protocol_Telnet) } }},
     {"VNC",         {{0,0,TableItem::Placeholder(StrCat(LS("host"),"[:",LS("port"),"]")),false,m->vnc_icon,        0,TableItem::TextInput,LS("vnc")},         {0,1,"",true},                                {0,2,m->pw_default,false,0,0,0,"",Callback(),TableItem::Flag::FixDropdown}, {2,0,"",false,m->settings_gray_icon,0,0,LS("vnc_settings"),        bind(&MyTerminalMenus::ShowProtocolSettings, m, LTerminal::Protocol_RFB) } }},
     {"Local Shell", {{0,0,"",                                                            false,m->terminal_icon,   0,TableItem::None,     LS("local_shell")}, {0,1,"",true},                                {0,2,"",true,0,0},                                                          {2,0,"",false,m->settings_gray_icon,0,0,LS("local_shell_settings"),bind(&MyTerminalMenus::ShowProtocolSettings, m, LTerminal::Protocol_LocalShell) }}}
@@ -657,6 +678,7 @@ void MyUpdateHostViewController::UpdateViewFromModel(const MyHostModel &host) {
   if      (host.protocol == LTerminal::Protocol_Telnet)     { hostv = host.hostname; proto_name = "Telnet"; }
   else if (host.protocol == LTerminal::Protocol_RFB)        { hostv = host.hostname; proto_name = "VNC"; }
   else if (host.protocol == LTerminal::Protocol_LocalShell) { hostv = "";            proto_name = "Local Shell"; }
+  else if (host.protocol == LTerminal::Protocol_Mosh)       { hostv = host.hostname; proto_name = "Mosh"; }
   else                                                      { hostv = host.hostname; proto_name = "SSH"; }
   view->BeginUpdates();
   view->ApplyChangeSet(pem ? "Key" : "Password", auth_deps);
@@ -753,6 +775,7 @@ void MyHostsViewController::UpdateViewFromModel(MyHostDB *model) {
     bool timestamp = true;
     int host_icon = menus->host_icon;
     if      (h->protocol() == LTerminal::Protocol_SSH)        { host_icon = menus->host_locked_icon; }
+    else if (h->protocol() == LTerminal::Protocol_Mosh)       { host_icon = menus->host_locked_icon; }
     else if (h->protocol() == LTerminal::Protocol_RFB)        { host_icon = menus->vnc_icon; }
     else if (h->protocol() == LTerminal::Protocol_LocalShell) { host_icon = menus->terminal_icon; timestamp = false; }
 
@@ -36,7 +36,7 @@ struct MyAutocompleteDB : public SQLiteIdValueStore { using SQLiteIdValueStore::
 
 struct MyHostSettingsModel {
   int settings_id, autocomplete_id, font_size;
-  bool agent_forwarding, compression, close_on_disconnect, hide_statusbar;
+  bool agent_forwarding, compression, close_on_disconnect, hide_statusbar, local_echo;
   string terminal_type, startup_command, font_name, color_scheme, keyboard_theme, prompt;
   LTerminal::BeepType beep_type;
   LTerminal::TextEncoding text_encoding;
@@ -44,13 +44,15 @@ struct MyHostSettingsModel {
   LTerminal::DeleteMode delete_mode;
   StringPairVec toolbar;
   vector<SSHClient::Params::Forward> local_forward, remote_forward;
+  unordered_map<int, int> local_forward_backlog;
+  vector<int> dynamic_forward;
 
   MyHostSettingsModel() { Load(); }
   MyHostSettingsModel(MySettingsDB *settings_db, int id) { Load(settings_db, id); }
 
   void Load() {
     settings_id = autocomplete_id = 0;
-    agent_forwarding = close_on_disconnect = 0;
+    agent_forwarding = close_on_disconnect = local_echo = 0;
     hide_statusbar   = !ANDROIDOS;
     compression      = 1;
     terminal_type    = "xterm-color";
@@ -74,6 +76,7 @@ struct MyHostSettingsModel {
     agent_forwarding = r.agent_forwarding();
     compression = r.compression();
     close_on_disconnect = r.close_on_disconnect();
+    local_echo = r.local_echo();
     terminal_type = GetFlatBufferString(r.terminal_type());
     startup_command = GetFlatBufferString(r.startup_command());
     font_name = r.font_name() ? r.font_name()->data() : FLAGS_font;
@@ -87,8 +90,12 @@ struct MyHostSettingsModel {
     autocomplete_id = r.autocomplete_id();
     prompt = GetFlatBufferString(r.prompt_string());
     if (auto ti = r.toolbar_items())  for (auto i : *ti) toolbar.emplace_back(GetFlatBufferString(i->key()), GetFlatBufferString(i->value()));
-    if (auto lf = r.local_forward())  for (auto i : *lf) local_forward .push_back({ i->port(), GetFlatBufferString(i->target()), i->target_port() });
+    if (auto lf = r.local_forward())  for (auto i : *lf) {
+      local_forward.push_back({ i->port(), GetFlatBufferString(i->target()), i->target_port() });
+      if (i->backlog()) local_forward_backlog[i->port()] = i->backlog();
+    }
     if (auto rf = r.remote_forward()) for (auto i : *rf) remote_forward.push_back({ i->port(), GetFlatBufferString(i->target()), i->target_port() });
+    if (auto df = r.dynamic_forward()) dynamic_forward.assign(df->begin(), df->end());
     hide_statusbar = flatbuffers::IsFieldPresent(&r, LTerminal::HostSettings::VT_HIDE_STATUSBAR) ? r.hide_statusbar() : !ANDROIDOS;
   }
 
@@ -96,7 +103,11 @@ struct MyHostSettingsModel {
     vector<flatbuffers::Offset<LTerminal::ToolbarItem>> tb;
     vector<flatbuffers::Offset<LTerminal::PortForward>> lf, rf;
     for (auto &i : toolbar)        tb.push_back(LTerminal::CreateToolbarItem(fb, fb.CreateString(i.first), fb.CreateString(i.second)));
-    for (auto &i : local_forward)  lf.push_back(LTerminal::CreatePortForward(fb, i.port, fb.CreateString(i.target_host), i.target_port));
+    for (auto &i : local_forward) {
+      auto backlog = local_forward_backlog.find(i.port);
+      lf.push_back(LTerminal::CreatePortForward(fb, i.port, fb.CreateString(i.target_host), i.target_port,
+                                                backlog != local_forward_backlog.end() ? backlog->second : 0));
+    }
     for (auto &i : remote_forward) rf.push_back(LTerminal::CreatePortForward(fb, i.port, fb.CreateString(i.target_host), i.target_port));
     fb.ForceDefaults(true);
     return LTerminal::CreateHostSettings
@@ -104,7 +115,8 @@ struct MyHostSettingsModel {
        fb.CreateString(startup_command), fb.CreateString(font_name), font_size, fb.CreateString(color_scheme),
        fb.CreateString(keyboard_theme), beep_type, text_encoding, enter_mode, delete_mode,
        tb.size() ? fb.CreateVector(tb) : 0, lf.size() ? fb.CreateVector(lf) : 0,
-       rf.size() ? fb.CreateVector(rf) : 0, autocomplete_id, fb.CreateString(prompt), hide_statusbar);
+       rf.size() ? fb.CreateVector(rf) : 0, autocomplete_id, fb.CreateString(prompt), hide_statusbar,
+       dynamic_forward.size() ? fb.CreateVector(dynamic_forward) : 0, local_echo);
   }
 
   FlatBufferPiece SaveBlob() const {
@@ -114,8 +126,8 @@ struct MyHostSettingsModel {
 
 struct MyAppSettingsModel {
   static const int LatestVersion = 1;
-  int version = LatestVersion, background_timeout = 180;
-  bool keep_display_on=0;
+  int version = LatestVersion, background_timeout = 180, identity_cache_ttl = 0;
+  bool keep_display_on=0, prewarm_hosts=0;
   MyHostSettingsModel default_host_settings;
 
   MyAppSettingsModel() {}
@@ -129,12 +141,14 @@ struct MyAppSettingsModel {
     default_host_settings.LoadProto(*s->default_host_settings());
     keep_display_on = s->keep_display_on();
     background_timeout = s->background_timeout();
+    prewarm_hosts = s->prewarm_hosts();
+    identity_cache_ttl = s->identity_cache_ttl();
   }
 
   flatbuffers::Offset<LTerminal::AppSettings> SaveProto(FlatBufferBuilder &fb) const {
     fb.ForceDefaults(true);
     return LTerminal::CreateAppSettings(fb, version, default_host_settings.SaveProto(fb), keep_display_on,
-                                        background_timeout);
+                                        background_timeout, 0, prewarm_hosts, identity_cache_ttl);
   }
 
   FlatBufferPiece SaveBlob() const {
@@ -218,6 +232,7 @@ struct MyHostModel {
     else if (p == LS("vnc"))         { protocol = LTerminal::Protocol_RFB;        username.clear(); }
     else if (p == LS("telnet"))      { protocol = LTerminal::Protocol_Telnet;     username.clear(); cred.Load(); }
     else if (p == LS("local_shell")) { protocol = LTerminal::Protocol_LocalShell; username.clear(); cred.Load(); }
+    else if (p == LS("mosh"))        { protocol = LTerminal::Protocol_Mosh; }
     else { FATAL("unknown protocol '", p, "'"); }
   }
 
@@ -227,6 +242,7 @@ struct MyHostModel {
     else if (protocol == LTerminal::Protocol_Telnet)     return 23;
     else if (protocol == LTerminal::Protocol_RFB)        return 5900;
     else if (protocol == LTerminal::Protocol_LocalShell) return 0;
+    else if (protocol == LTerminal::Protocol_Mosh)       return 22;
     else { FATAL("unknown protocol"); }
   };
 
@@ -326,6 +342,54 @@ struct MyGenKeyModel {
   int bits=0;
 };
 
+struct MyGenKeyJob {
+  MyGenKeyModel gk;
+  string pubkey, privkey;
+  bool success=0;
+  atomic<bool> canceled{false}, finished{false};
+};
+
+struct MyWorkerPool {
+  int max_workers, idle_workers=0;
+  mutex queue_mutex;
+  condition_variable queue_cv;
+  deque<Callback> queue;
+  vector<thread> workers;
+  bool done=0;
+  MyWorkerPool(int n) : max_workers(max(1, n)) {}
+  ~MyWorkerPool() {
+    { lock_guard<mutex> lock(queue_mutex); done = true; queue.clear(); }
+    queue_cv.notify_all();
+    for (auto &w : workers) w.join();
+  }
+
+  void Run(Callback cb) {
+    {
+      lock_guard<mutex> lock(queue_mutex);
+      queue.push_back(move(cb));
+      if (int(workers.size()) < max_workers && idle_workers < int(queue.size()))
+        workers.emplace_back(&MyWorkerPool::WorkerThread, this);
+    }
+    queue_cv.notify_one();
+  }
+
+  void WorkerThread() {
+    for (;;) {
+      Callback cb;
+      {
+        unique_lock<mutex> lock(queue_mutex);
+        idle_workers++;
+        queue_cv.wait(lock, [&](){ return done || queue.size(); });
+        idle_workers--;
+        if (done) return;
+        cb = move(queue.front());
+        queue.pop_front();
+      }
+      cb();
+    }
+  }
+};
+
 struct MyTableViewController : public TableViewController {
   MyTableViewController(MyTerminalMenus*, unique_ptr<TableViewInterface> = unique_ptr<TableViewInterface>());
 };
@@ -495,7 +559,7 @@ struct MyUpgradeViewController : public MyTableViewController {
 
 struct MyTerminalMenus {
   typedef function<void(TerminalTabInterface*, int, const string&)> SavehostCB;
-  bool pro_version = true, db_protected = false, db_opened = false, suspended_timer = false;
+  bool pro_version = true, db_protected = false, db_opened = false, suspended_timer = false, prewarm_hosts = false;
   WindowHolder *win;
   ToolkitInterface *toolkit;
   SQLite::Database db;
@@ -504,6 +568,11 @@ struct MyTerminalMenus {
   MySettingsDB settings_db;
   vector<MyTableViewController*> tableviews;
   unordered_map<int, shared_ptr<SSHClient::Identity>> identity_loaded;
+  unordered_map<int, Time> identity_expires;
+  unordered_map<int, vector<SSHClient::IdentityCB>> identity_waiters;
+  Time identity_cache_ttl = Time::zero();
+  unordered_set<shared_ptr<MyGenKeyJob>> keygen_jobs;
+  MyWorkerPool keygen_pool{int(thread::hardware_concurrency())};
   int key_icon, host_icon, host_locked_icon, bolt_icon, terminal_icon, settings_blue_icon, settings_gray_icon,
       audio_icon, eye_icon, recycle_icon, fingerprint_icon, info_icon, keyboard_icon, folder_icon, logo_image, logo_icon,
       plus_red_icon, plus_green_icon, vnc_icon, locked_icon, unlocked_icon, font_icon, toys_icon,
@@ -514,7 +583,7 @@ struct MyTerminalMenus {
   PickerItem color_picker = PickerItem{ {{"VGA", "Solarized Dark", "Solarized Light"}}, {0} };
   Color green;
 
-  unique_ptr<TimerInterface>          sessions_update_timer;
+  unique_ptr<TimerInterface>          sessions_update_timer, identity_expire_timer;
   unique_ptr<NavigationViewInterface> hosts_nav, interfacesettings_nav;
   unique_ptr<TextViewInterface>       credits;
   unique_ptr<PurchasesInterface>      purchases;
@@ -557,7 +626,7 @@ struct MyTerminalMenus {
     { "[pgdown]", bind([=]{ if (auto t = GetActiveTerminalTab()) { t->terminal->PageDown();    if (t->controller->frame_on_keyboard_input) app->focused->Wakeup(); } }) },
     { "[home]",   bind([=]{ if (auto t = GetActiveTerminalTab()) { t->terminal->Home();        if (t->controller->frame_on_keyboard_input) app->focused->Wakeup(); } }) },
     { "[end]",    bind([=]{ if (auto t = GetActiveTerminalTab()) { t->terminal->End();         if (t->controller->frame_on_keyboard_input) app->focused->Wakeup(); } }) },
-    { "[paste]",  bind([=]{ if (auto t = GetActiveTerminalTab()) { t->terminal->InputString(app->GetClipboardText()); } }) },
+    { "[paste]",  bind([=]{ if (auto t = GetActiveTerminalTab()) { t->PasteText(app->GetClipboardText()); } }) },
     { "[console]",bind([=]{ if (auto w = GetActiveWindow()) { if (!w->root->console) w->root->InitConsole(bind(&MyTerminalWindow::ConsoleAnimatingCB, w)); w->root->shell->console(StringVec()); } }) },
   };
 
@@ -633,6 +702,7 @@ struct MyTerminalMenus {
     none_icon              (CheckNotNull(app->system_toolkit->LoadImage("none"))),
     icon_fb(app->focused), theme(Application::GetSetting("theme")), green(76, 217, 100),
     sessions_update_timer(SystemToolkit::CreateTimer(bind(&MyTerminalMenus::UpdateMainMenuSessionsSectionTimer, this))),
+    identity_expire_timer(SystemToolkit::CreateTimer(bind(&MyTerminalMenus::ExpireIdentities, this))),
     hosts_nav(app->system_toolkit->CreateNavigationView(app->focused, "", theme)),
     interfacesettings_nav(app->system_toolkit->CreateNavigationView(app->focused, "", theme)), addtoolbaritem(this),
     keyboardsettings(this), newkey(this), genkey(this), keyinfo(this), keys(this, &credential_db), about(this),
@@ -739,6 +809,29 @@ struct MyTerminalMenus {
     MyAppSettingsModel global_settings(&settings_db);
     app->background_timeout = global_settings.background_timeout;
     app->SetKeepScreenOn(global_settings.keep_display_on);
+    prewarm_hosts = global_settings.prewarm_hosts;
+    identity_cache_ttl = Seconds(global_settings.identity_cache_ttl * 60);
+  }
+
+  void PrewarmHosts(int max_hosts=5) {
+    if (!prewarm_hosts || !app->network_thread) return;
+    vector<SQLiteIdValueStore::EntryPointer> sorted;
+    for (auto &host : host_db.data)
+      if (host.first != 1) sorted.push_back({ host.first, &host.second.blob, host.second.date });
+    sort(sorted.begin(), sorted.end(),
+         MemberGreaterThanCompare<SQLiteIdValueStore::EntryPointer, Time, &SQLiteIdValueStore::EntryPointer::date>());
+
+    vector<string> prewarm;
+    for (auto &host : sorted) {
+      const LTerminal::Host *h = flatbuffers::GetRoot<LTerminal::Host>(host.blob->data());
+      if (h->protocol() == LTerminal::Protocol_LocalShell) continue;
+      string hostport = GetFlatBufferString(h->hostport());
+      prewarm.push_back(hostport.substr(0, hostport.find(':')));
+      if (int(prewarm.size()) >= max_hosts) break;
+    }
+    app->RunInNetworkThread([=](){
+      for (auto &h : prewarm) Singleton<TerminalDNSCache>::Get()->Lookup(h, function<void(IPV4::Addr)>());
+    });
   }
 
   void ChangeTheme(const string &v) {
@@ -762,6 +855,7 @@ struct MyTerminalMenus {
 
   void UpdateModelFromSettingsView(LTerminal::Protocol proto, MyHostSettingsModel *model, string *folder) {
     switch(proto) {
+       case LTerminal::Protocol_Mosh:
        case LTerminal::Protocol_SSH:        sshsettings       .UpdateModelFromView(model, folder); break;
        case LTerminal::Protocol_Telnet:     telnetsettings    .UpdateModelFromView(model, folder); break;
        case LTerminal::Protocol_RFB:        vncsettings       .UpdateModelFromView(model, folder); break;
@@ -775,6 +869,7 @@ struct MyTerminalMenus {
        case LTerminal::Protocol_LocalShell: localshellsettings.UpdateViewFromModel(model); break;
        case LTerminal::Protocol_Telnet:     telnetsettings    .UpdateViewFromModel(model); break;
        case LTerminal::Protocol_RFB:        vncsettings       .UpdateViewFromModel(model); break;
+       case LTerminal::Protocol_Mosh:
        case LTerminal::Protocol_SSH: sshsettings.UpdateViewFromModel(model); sshfingerprint.UpdateViewFromModel(model); break;
        default: ERROR("unknown protocol ", proto); break;
     }
@@ -787,7 +882,37 @@ struct MyTerminalMenus {
 
     string pubkey, privkey;
     if (!Crypto::GenerateKey(gk.algo, gk.bits, gk.pw, gk.pw, &pubkey, &privkey)) return ERRORv(0, "generate ", gk.algo, " key");
+    return SaveGeneratedKey(gk, privkey);
+  }
+
+  shared_ptr<MyGenKeyJob> GenerateKeyInBackground() {
+    auto job = make_shared<MyGenKeyJob>();
+    genkey.UpdateModelFromView(&job->gk);
+    hosts_nav->PopView(1);
+    keygen_jobs.insert(job);
+    weak_ptr<MyGenKeyJob> weak_job = job;
+    app->keygen_alert->ShowCB(LS("generating_key"), StrCat(job->gk.algo, " ", job->gk.bits, " ", LS("bits")), "",
+                              [=](const string&) { if (auto j = weak_job.lock()) j->canceled = true; });
+    keygen_pool.Run([=](){
+      auto j = weak_job.lock();
+      if (!j) return;
+      if (!j->canceled)
+        j->success = Crypto::GenerateKey(j->gk.algo, j->gk.bits, j->gk.pw, j->gk.pw, &j->pubkey, &j->privkey);
+      j->finished = true;
+      app->RunInMainThread([=](){ if (auto j = weak_job.lock()) GenerateKeyDone(j); });
+    });
+    return job;
+  }
 
+  void GenerateKeyDone(shared_ptr<MyGenKeyJob> job) {
+    if (!keygen_jobs.erase(job)) return;
+    if (keygen_jobs.empty()) app->keygen_alert->Hide();
+    if (job->canceled) return INFO("generate ", job->gk.algo, " key canceled");
+    if (!job->success) return app->info_alert->ShowCB(LS("generate_key_failed"), StrCat(job->gk.algo, " ", job->gk.bits), "", StringCB());
+    SaveGeneratedKey(job->gk, job->privkey);
+  }
+
+  int SaveGeneratedKey(const MyGenKeyModel &gk, const string &privkey) {
     MyCredentialModel cred(CredentialType_PEM, privkey, gk.name);
     cred.gentype = StrCat(gk.algo, " Key");
     cred.gendate = localhttptime(Now());
@@ -797,7 +922,7 @@ struct MyTerminalMenus {
     shared_ptr<SSHClient::Identity> new_identity = make_shared<SSHClient::Identity>();
     if (!Crypto::ParsePEM(cred.creddata.c_str(), &new_identity->rsa, &new_identity->dsa,
                           &new_identity->ec, &new_identity->ed25519, [&](string) { return gk.pw; })) return ERRORv(0, "load just generated key failed");
-    identity_loaded[row_id] = new_identity;
+    CacheIdentity(row_id, new_identity);
     return row_id;
   }
   
@@ -889,6 +1014,13 @@ struct MyTerminalMenus {
     hosts_nav->Show(true);
     app->ShowSystemStatusBar(true);
     sessions_update_timer->Run(Seconds(1), true);
+    PrewarmHosts();
+  }
+
+  static string ForwardSummary(TerminalTabInterface *t) {
+    auto ssh = dynamic_cast<SSHTerminalController*>(t->controller.get());
+    string summary = ssh ? ssh->ForwardSummary() : "";
+    return summary.size() ? StrCat(", ", summary) : summary;
   }
 
   void ReplaceMainMenuSessionsSection() {
@@ -903,7 +1035,7 @@ struct MyTerminalMenus {
 
       section.emplace_back
         (t->title, TableItem::Command,
-         t->networked ? (t->connected != Time::zero() ? StrCat(LS("connected"), " ", intervalminutes(now - t->connected)) : LS(tolower(Connection::StateName(conn_state)).c_str())) : "",
+         t->networked ? (t->connected != Time::zero() ? StrCat(LS("connected"), " ", intervalminutes(now - t->connected), ForwardSummary(t)) : LS(tolower(Connection::StateName(conn_state)).c_str())) : "",
          "", 0, t->thumbnail_system_image, ex_icon, [=](){
            HideMainMenu();
            tw->tabs.SelectTab(t);
@@ -958,7 +1090,7 @@ struct MyTerminalMenus {
         if (t->connected != Time::zero()) { 
           still_counting = true;
           color.emplace_back(0,255,0);
-          val.emplace_back(StrCat(LS("connected"), " ", intervalminutes(now - t->connected)));
+          val.emplace_back(StrCat(LS("connected"), " ", intervalminutes(now - t->connected), ForwardSummary(t)));
         } else { 
           int conn_state = t->GetConnectionState();
           color.emplace_back(Connection::ConnectState(conn_state) ? Color(0,255,0) : Color(255,0,0));
@@ -1050,6 +1182,7 @@ struct MyTerminalMenus {
        case LTerminal::Protocol_LocalShell: hosts_nav->PushTableView(localshellsettings.view.get()); break;
        case LTerminal::Protocol_Telnet:     hosts_nav->PushTableView(telnetsettings    .view.get()); break;
        case LTerminal::Protocol_RFB:        hosts_nav->PushTableView(vncsettings       .view.get()); break;
+       case LTerminal::Protocol_Mosh:
        case LTerminal::Protocol_SSH:        hosts_nav->PushTableView(sshsettings       .view.get()); break;
        default: ERROR("unknown protocol ", proto); break;
     }
@@ -1078,6 +1211,8 @@ struct MyTerminalMenus {
 
   void DeleteKey(int index, int key_id) {
     credential_db.Erase(key_id);
+    identity_loaded.erase(key_id);
+    identity_expires.erase(key_id);
   }
 
   void DeleteHost(int index, int host_id) {
@@ -1138,27 +1273,60 @@ struct MyTerminalMenus {
     app->focused->Wakeup();
   }
 
+  void CacheIdentity(int cred_id, shared_ptr<SSHClient::Identity> identity) {
+    identity_loaded[cred_id] = move(identity);
+    if (identity_cache_ttl == Time::zero()) return ReturnVoid(identity_expires.erase(cred_id));
+    identity_expires[cred_id] = Now() + identity_cache_ttl;
+    ExpireIdentities();
+  }
+
+  void ExpireIdentities() {
+    Time now = Now(), next = Time::zero();
+    for (auto i = identity_expires.begin(); i != identity_expires.end(); /**/) {
+      if (now < i->second) { next = (next == Time::zero()) ? i->second : min(next, i->second); ++i; continue; }
+      identity_loaded.erase(i->first);
+      i = identity_expires.erase(i);
+    }
+    if (next != Time::zero()) identity_expire_timer->Run(next - now, true);
+  }
+
   shared_ptr<SSHClient::Identity> LoadIdentity(const MyCredentialModel &cred) {
     CHECK(cred.cred_id);
     auto it = identity_loaded.find(cred.cred_id);
-    if (it != identity_loaded.end()) return it->second;
+    if (it != identity_loaded.end()) {
+      auto expires = identity_expires.find(cred.cred_id);
+      if (expires == identity_expires.end() || Now() < expires->second) return it->second;
+      identity_loaded.erase(it);
+      identity_expires.erase(expires);
+    }
 
     bool password_needed = false;
     shared_ptr<SSHClient::Identity> identity = make_shared<SSHClient::Identity>();
     Crypto::ParsePEM(cred.creddata.c_str(), &identity->rsa, &identity->dsa, &identity->ec,
                      &identity->ed25519, [&](string v) { password_needed = true; return ""; });
-    if (!password_needed) identity_loaded[cred.cred_id] = identity;
+    if (!password_needed) CacheIdentity(cred.cred_id, identity);
     return password_needed ? nullptr : identity;
   }
 
   void LoadNewIdentity(const MyCredentialModel &cred, SSHClient::IdentityCB success_cb) {
+    int cred_id = cred.cred_id;
+    string creddata = cred.creddata;
+    for (auto i = identity_waiters.begin(); i != identity_waiters.end(); /**/) {
+      if (i->first == cred_id) ++i;
+      else i = identity_waiters.erase(i);
+    }
+    identity_waiters[cred_id].push_back(move(success_cb));
     app->passphrase_alert->ShowCB
       (LS("identity_passphrase"), LS("passphrase"), "", [=](const string &v) {
          shared_ptr<SSHClient::Identity> new_identity = make_shared<SSHClient::Identity>();
-         if (!Crypto::ParsePEM(cred.creddata.c_str(), &new_identity->rsa, &new_identity->dsa,
-                               &new_identity->ec, &new_identity->ed25519, [=](string) { return v; })) return;
-         identity_loaded[cred.cred_id] = new_identity;
-         if (success_cb) success_cb(new_identity);
+         bool success = Crypto::ParsePEM(creddata.c_str(), &new_identity->rsa, &new_identity->dsa,
+                                         &new_identity->ec, &new_identity->ed25519, [=](string) { return v; });
+         vector<SSHClient::IdentityCB> waiters;
+         swap(waiters, identity_waiters[cred_id]);
+         identity_waiters.erase(cred_id);
+         if (!success) return;
+         CacheIdentity(cred_id, new_identity);
+         for (auto &cb : waiters) if (cb) cb(new_identity);
        });
   }
 
@@ -1179,12 +1347,15 @@ struct MyTerminalMenus {
          host.settings.compression, host.settings.agent_forwarding, host.settings.close_on_disconnect, true,
          host.settings.local_forward, host.settings.remote_forward }, false,
          host.cred.credtype == LTerminal::CredentialType_Password ? host.cred.creddata : "",
-         move(reconnect_identity_cb), bind(move(cb), tab, _1, _2), move(fingerprint_cb));
+         move(reconnect_identity_cb), bind(move(cb), tab, _1, _2), move(fingerprint_cb),
+         host.settings.local_forward_backlog, host.settings.dynamic_forward, host.settings.local_echo);
       ApplyTerminalSettings(host.settings);
+      weak_ptr<bool> alive = ssh->alive;
       if (host.username.empty()) {
         ssh->identity_cb = [=](shared_ptr<SSHClient::Identity> *out) { 
           app->text_alert->ShowCB
             (LS("login"), LS("username"), "", [=](const string &v) {
+              if (alive.expired() || !ssh->conn) return;
               SSHClient::SendAuthenticationRequest(ssh->conn, shared_ptr<SSHClient::Identity>(), &v);
             });
           return false;
@@ -1193,6 +1364,7 @@ struct MyTerminalMenus {
         ssh->identity_cb = [=](shared_ptr<SSHClient::Identity> *out) { 
           if ((*out = LoadIdentity(host.cred))) return true;
           LoadNewIdentity(host.cred, [=](shared_ptr<SSHClient::Identity> identity){
+            if (alive.expired() || !ssh->conn) return;
             SSHClient::SendAuthenticationRequest(ssh->conn, identity);
           });
           return false;
@@ -1209,6 +1381,20 @@ struct MyTerminalMenus {
         (host.host_id, host.settings.hide_statusbar, RFBClient::Params{host.Hostport()},
          host.cred.credtype == LTerminal::CredentialType_Password ? host.cred.creddata : "",
          (bool(cb) ? bind(move(cb), _1, 0, "") : TerminalTabCB()), move(toolbar));
+#ifdef LFL_MOSH
+    } else if (host.protocol == LTerminal::Protocol_Mosh) {
+      SSHClient::LoadIdentityCB identity_cb;
+      if (host.cred.credtype == LTerminal::CredentialType_PEM)
+        identity_cb = [=](shared_ptr<SSHClient::Identity> *out) { *out = LoadIdentity(host.cred); return true; };
+      auto tab = GetActiveWindow()->AddTerminalTab(host.host_id, host.settings.hide_statusbar, move(toolbar));
+      tab->UseMoshTerminalController
+        (SSHClient::Params{ host.Hostport(), host.username, host.settings.terminal_type, "",
+         host.settings.compression, false, true, true },
+         host.cred.credtype == LTerminal::CredentialType_Password ? host.cred.creddata : "",
+         move(identity_cb), move(fingerprint_cb));
+      if (cb) cb(tab, 0, "");
+      ApplyTerminalSettings(host.settings);
+#endif
     } else if (host.protocol == LTerminal::Protocol_LocalShell) {
       auto tab = GetActiveWindow()->AddTerminalTab(host.host_id, host.settings.hide_statusbar, move(toolbar));
       tab->UseShellTerminalController("");
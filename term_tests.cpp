@@ -1,4 +1,7 @@
 #include "gtest/gtest.h"
+#include "zlib.h"
+#include <signal.h>
+#include <sys/socket.h>
 #include "core/app/app.h"
 #include "core/app/shell.h"
 #include "core/app/gl/view.h"
@@ -19,7 +22,8 @@ struct MyApp : public Application {
   using Application::Application;
   unique_ptr<Browser> image_browser;
   unique_ptr<TimerInterface> flash_timer;
-  unique_ptr<AlertViewInterface> flash_alert, info_alert, confirm_alert, text_alert, passphrase_alert, passphraseconfirm_alert;
+  unique_ptr<AlertViewInterface> flash_alert, info_alert, confirm_alert, text_alert, passphrase_alert, passphraseconfirm_alert,
+    keygen_alert, paste_alert;
   unique_ptr<MenuViewInterface> edit_menu, view_menu, toys_menu;
   unique_ptr<MyTerminalMenus> menus;
   int background_timeout = 180;
@@ -49,6 +53,7 @@ struct MyTerminalTab : public TerminalTab {
     TerminalTab(W, W->AddView(make_unique<Terminal>(nullptr, W, W->default_font, point(80,25))), host_id, hide_sb), parent(P) {}
 
   void ChangeColors(const string &colors_name, bool redraw=true) {}
+  void PasteText(const string &text) {}
   void UseShellTerminalController(const string &m, bool commands=true, Callback reconnect_cb=Callback()) {}
   void UseTelnetTerminalController(const string &hostport, bool from_shell=false, bool close_on_disconn=false,
                                    Callback savehost_cb=Callback()) {}
@@ -57,7 +62,9 @@ struct MyTerminalTab : public TerminalTab {
   UseSSHTerminalController(SSHClient::Params params, bool from_shell=false, const string &pw="",
                            SSHClient::LoadIdentityCB identity_cb=SSHClient::LoadIdentityCB(),
                            SSHTerminalController::SavehostCB savehost_cb=SSHTerminalController::SavehostCB(),
-                           SSHClient::FingerprintCB fingerprint_cb=SSHClient::FingerprintCB()) { return nullptr; }
+                           SSHClient::FingerprintCB fingerprint_cb=SSHClient::FingerprintCB(),
+                           unordered_map<int, int> forward_backlog=unordered_map<int, int>(),
+                           vector<int> forward_dynamic=vector<int>(), bool local_echo=false) { return nullptr; }
 };
 
 inline MyTerminalWindow *GetActiveWindow() {
@@ -187,3 +194,208 @@ TEST(MenusTest, GenerateKey) {
   }
 }
 
+TEST(MenusTest, GenerateKeyInBackground) {
+  app->menus->genkey.view->SetSectionValues(1, StringVec{"Ed25519"});
+  app->menus->genkey.view->SetSectionValues(2, StringVec{"256"});
+  size_t loaded = app->menus->identity_loaded.size();
+  auto job = app->menus->GenerateKeyInBackground();
+  auto canceled = app->menus->GenerateKeyInBackground();
+  canceled->canceled = true;
+  for (int i = 0; i < 1000 && !(job->finished && canceled->finished); i++) this_thread::sleep_for(Time(10));
+  ASSERT_TRUE(job->finished);
+  ASSERT_TRUE(canceled->finished);
+  EXPECT_TRUE(job->success);
+  EXPECT_FALSE(job->canceled);
+  EXPECT_NE(string(), job->privkey);
+
+  app->menus->GenerateKeyDone(job);
+  app->menus->GenerateKeyDone(canceled);
+  app->menus->GenerateKeyDone(job);
+  EXPECT_TRUE(app->menus->keygen_jobs.empty());
+  EXPECT_EQ(loaded + 1, app->menus->identity_loaded.size());
+}
+
+TEST(TerminalTest, ReadCoalescer) {
+  TerminalReadCoalescer join_reads(Time(33), 255, 16384);
+  Time now = Time(1000);
+  for (int i = 0; i < 10; i++, now += Time(100)) EXPECT_FALSE(join_reads.DeferDraw(1, now));
+  EXPECT_TRUE(join_reads.DeferDraw(4096, now));
+  for (int i = 0; i < 10; i++, now += Time(10)) EXPECT_TRUE(join_reads.DeferDraw(200, now));
+  now += Time(1000);
+  EXPECT_FALSE(join_reads.DeferDraw(1, now));
+  for (int i = 0; i < 25; i++, now += Time(10)) join_reads.DeferDraw(200, now);
+  now += Time(10);
+  EXPECT_TRUE (join_reads.DeferDraw(1, now));
+  now += Time(1000);
+  EXPECT_FALSE(join_reads.DeferDraw(1, now));
+}
+
+TEST(TerminalTest, LocalEcho) {
+  TerminalLocalEcho echo;
+  string out = "l";
+  echo.Typed("l", point(1, 1), 80);
+  EXPECT_EQ("", echo.out);
+  echo.Output(&out, point(1, 1), 80);
+  EXPECT_EQ("l", out);
+  EXPECT_TRUE(echo.confirmed);
+
+  echo.Typed("sx", point(2, 1), 80);
+  EXPECT_EQ("\x1b[4ms\x1b[24m\x1b[4mx\x1b[24m", echo.out);
+  echo.out.clear();
+  out = "s";
+  echo.Output(&out, point(4, 1), 80);
+  EXPECT_EQ("\x1b[1;2H  \x1b[1;2Hs\x1b[4mx\x1b[24m", out);
+  out = "x";
+  echo.Output(&out, point(4, 1), 80);
+  EXPECT_EQ("\x1b[1;3H \x1b[1;3Hx", out);
+
+  echo.Typed("\x1b[?1;2c\x1b[5;4R", point(4, 1), 80);
+  EXPECT_TRUE(echo.confirmed);
+  EXPECT_EQ("", echo.pending);
+  echo.Typed("\x1b[A", point(4, 1), 80);
+  EXPECT_FALSE(echo.confirmed);
+  out = "y";
+  echo.Typed("y", point(4, 1), 80);
+  echo.Output(&out, point(4, 1), 80);
+  EXPECT_TRUE(echo.confirmed);
+
+  echo.Typed("abc", point(9, 2), 10);
+  EXPECT_EQ("\x1b[4ma\x1b[24m\x1b[4mb\x1b[24m", echo.out);
+  echo.out.clear();
+  out = "a";
+  echo.Output(&out, point(11, 2), 10);
+  EXPECT_EQ("\x1b[2;9H  \x1b[2;9Ha\x1b[4mb\x1b[24m", out);
+  out = "bc";
+  echo.Output(&out, point(11, 2), 10);
+  EXPECT_EQ("\x1b[2;10H \x1b[2;10Hbc", out);
+  EXPECT_EQ("", echo.pending);
+
+  echo.Typed("\r", point(1, 3), 80);
+  EXPECT_FALSE(echo.confirmed);
+  echo.Typed("pw", point(1, 3), 80);
+  EXPECT_EQ("", echo.out);
+  out = "\r\nPassword: ";
+  echo.Output(&out, point(1, 3), 80);
+  EXPECT_EQ("\r\nPassword: ", out);
+  EXPECT_FALSE(echo.confirmed);
+  EXPECT_EQ("", echo.pending);
+}
+
+TEST(TerminalTest, PasteStreamer) {
+  struct ShortWriteController : public TerminalControllerInterface {
+    string written;
+    size_t queued = 0;
+    ShortWriteController() : TerminalControllerInterface(nullptr) {}
+    Socket Open(TextArea*) { return InvalidSocket; }
+    StringPiece Read() { return StringPiece(); }
+    int Write(const StringPiece &b) { int n = min<int>(3, b.size()); written.append(b.data(), n); return n; }
+    void IOCtlWindowSize(int w, int h) {}
+    size_t GetWriteQueueSize() const { return queued; }
+  } controller;
+
+  TerminalPasteStreamer paste("ab\r\ncd\nef", false, 8);
+  EXPECT_EQ("ab\rcd\ref", paste.data);
+  controller.queued = 8;
+  EXPECT_EQ(0, paste.Step(&controller));
+  controller.queued = 0;
+  while (!paste.Done()) EXPECT_LT(0, paste.Step(&controller));
+  EXPECT_EQ(paste.data, controller.written);
+
+  TerminalPasteStreamer bracketed("a\nb\x1b[201~c", true);
+  EXPECT_EQ("\x1b[200~a\rbc\x1b[201~", bracketed.data);
+
+  TerminalPasteMode mode;
+  mode.Scan("x\x1b[?20");
+  EXPECT_FALSE(mode.bracketed);
+  mode.Scan("04hy");
+  EXPECT_TRUE(mode.bracketed);
+  mode.Scan("\x1b[?2004l");
+  EXPECT_FALSE(mode.bracketed);
+}
+
+TEST(TerminalTest, InteractiveBatchedWrite) {
+  MyTerminalTab tab(app->focused, nullptr, 0, false);
+  InteractiveTerminalController shell(&tab, &app->localfs);
+  StringVec ran;
+  shell.cmd.runcb = [&](const string &c){ ran.push_back(c); };
+
+  string typed = "ls\rpwd\r\x1b[200~echo a\r\necho b\x1b[201~x\x7f";
+  EXPECT_EQ(int(typed.size()), shell.Write(typed));
+  EXPECT_FALSE(shell.pasting);
+  EXPECT_EQ(StringVec({ "ls", "pwd", "echo a" }), ran);
+  EXPECT_EQ("echo b", String::ToUTF8(shell.cmd.cmd_line.Text16()));
+
+  shell.Write("\r\x1b[200~split");
+  EXPECT_TRUE(shell.pasting);
+  shell.Write("\n\x1b[201~");
+  EXPECT_FALSE(shell.pasting);
+  EXPECT_EQ(StringVec({ "ls", "pwd", "echo a", "echo b", "split" }), ran);
+  EXPECT_EQ("", String::ToUTF8(shell.cmd.cmd_line.Text16()));
+
+  shell.Write("\x1bOA");
+  EXPECT_EQ("split", String::ToUTF8(shell.cmd.cmd_line.Text16()));
+}
+
+TEST(TerminalTest, RecordRoundTrip) {
+  string fn = StrCat(app->savedir, "record_test.rec"), expect, expect_after_keyframe;
+  vector<string> chunks;
+  for (int i = 0; i < 100; i++) chunks.push_back(StrCat("line ", i, " \x1b[1mbold\x1b[0m ", string(i % 7 + 1, 'x'), "\r\n"));
+  {
+    TerminalRecorder recorder(fn, Time(1000), TerminalRecorder::Policy::Block, true);
+    recorder.block_size = 256;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      bool keyframe = i == 0 || i == 50;
+      EXPECT_TRUE(recorder.Add(Time(i * 20), chunks[i], keyframe, keyframe ? StrCat("snapshot", i) : string()));
+      expect += chunks[i];
+      if (i >= 50) expect_after_keyframe += chunks[i];
+    }
+  }
+
+  unsigned long long stamp = 0, last_stamp = 0;
+  string data, got;
+  TerminalRecordReader reader(fn);
+  while (reader.Next(&stamp, &data)) { EXPECT_LE(last_stamp, stamp); last_stamp = stamp; got += data; }
+  EXPECT_EQ(expect, got);
+  EXPECT_EQ(99 * 20ULL, last_stamp);
+
+  vector<pair<unsigned long long, unsigned long long>> index;
+  FlatFile index_file(StrCat(fn, ".index"));
+  while (auto k = index_file.Next<LTerminal::RecordKeyframe>()) {
+    index.emplace_back(k->stamp(), k->offset());
+    EXPECT_EQ(StrCat("snapshot", k->stamp() / 20), string(MakeSigned(k->snapshot()->data()), k->snapshot()->size()));
+  }
+  ASSERT_EQ(size_t(2), index.size());
+  EXPECT_EQ(50 * 20ULL, index[1].first);
+
+  got.clear();
+  reader.Seek(index[1].second);
+  ASSERT_TRUE(reader.Next(&stamp, &data));
+  EXPECT_EQ(50 * 20ULL, stamp);
+  got += data;
+  while (reader.Next(&stamp, &data)) got += data;
+  EXPECT_EQ(expect_after_keyframe, got);
+  app->localfs.unlink(fn);
+  app->localfs.unlink(StrCat(fn, ".index"));
+}
+
+TEST(TerminalTest, ForwardCloseWithQueuedWrite) {
+  signal(SIGPIPE, SIG_IGN);
+  MyTerminalTab tab(app->focused, nullptr, 0, false);
+  SSHTerminalController ssh(&tab, SSHClient::Params(), Callback());
+  SSHClient::Channel chan;
+  int fd[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fd));
+  auto f = ssh.AddForwardSocket(fd[0], &chan);
+  EXPECT_TRUE(ssh.PortForwardLocalWrite(fd[0], f, string(4*1024*1024, 'x')));
+  EXPECT_TRUE(f->WriteQueued());
+
+  ssh.PortForwardRemoteCloseCB(fd[0], &chan);
+  ASSERT_EQ(size_t(1), ssh.forward_sockets.count(fd[0]));
+  EXPECT_TRUE(f->closing);
+  EXPECT_EQ(nullptr, f->chan);
+
+  close(fd[1]);
+  EXPECT_FALSE(ssh.PortForwardLocalReadyCB(fd[0]));
+  EXPECT_EQ(size_t(0), ssh.forward_sockets.count(fd[0]));
+  EXPECT_EQ(size_t(0), ssh.forward_fd.count(fd[0]));
+}